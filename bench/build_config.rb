@@ -0,0 +1,22 @@
+# Build configuration for the CMath microbenchmarks; see `rake bench`.
+# The default gembox is not used because it brings in the core
+# mruby-cmath gem, which defines the same CMath module.  With BRANCHLESS
+# set, the gem is built with CMATH_BRANCHLESS, as a separate build.
+MRuby::Build.new(ENV['BRANCHLESS'] ? 'branchless' : 'host') do |conf|
+  conf.toolchain
+
+  conf.gem :core => 'mruby-print'
+  conf.gem :core => 'mruby-sprintf'
+  conf.gem :core => 'mruby-math'
+  conf.gem :core => 'mruby-complex'
+  conf.gem :core => 'mruby-array-ext'
+  conf.gem :core => 'mruby-string-ext'
+  conf.gem :core => 'mruby-numeric-ext'
+  conf.gem :core => 'mruby-enum-ext'
+  conf.gem File.expand_path('..', __dir__) do |g|
+    g.cc.defines << 'CMATH_BRANCHLESS' if ENV['BRANCHLESS']
+  end
+  conf.gem __dir__
+
+  conf.cc.flags << '-O2'
+end
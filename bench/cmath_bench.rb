@@ -0,0 +1,84 @@
+##
+# CMath microbenchmarks, run by the mruby-cmath-bench driver:
+#
+#   mruby-cmath-bench bench/cmath_bench.rb [--text] [pattern]
+#
+# Every function is timed for every input class.  A case is calibrated
+# to run for at least MIN_TIME_NS, then timed REPEAT times; the median
+# is reported, with the minimum as a noise check.  Output is JSON on
+# stdout unless --text is given.  Only functions whose name contains
+# pattern are run.
+
+REPEAT = 7
+MIN_TIME_NS = 20_000_000
+BATCH_SIZE = 1024
+
+FUNCTIONS = %i(
+  exp log log10 log2 sqrt cis
+  sin cos tan asin acos atan
+  sinh cosh tanh asinh acosh atanh
+  sincos sinhcosh
+)
+
+INPUTS = [
+  ["integer", 3],
+  ["float", 0.7],
+  ["positive_real", 2.5],
+  ["negative_real", -2.5],
+  ["complex", Complex(0.6, -1.3)],
+  ["large_complex", Complex(1.0e10, -3.0e9)],
+  ["branch_cut", Complex(-2.0, 1.0e-300)],
+  ["nan", Complex(Float::NAN, 1.0)],
+  ["infinity", Complex(Float::INFINITY, -1.0)],
+]
+
+def median(a)
+  s = a.sort
+  s[s.size / 2]
+end
+
+# Returns [median ns per call, minimum ns per call]
+def run_case(name, arg, elements)
+  count = 1
+  while Bench.measure(name, arg, count) < MIN_TIME_NS / 10
+    count *= 4
+  end
+  count = count * 10
+  times = (1..REPEAT).map { Bench.measure(name, arg, count).to_f / count / elements }
+  [median(times), times.min]
+end
+
+text = ARGV.delete("--text")
+pattern = ARGV[0]
+
+results = []
+FUNCTIONS.each do |f|
+  next if pattern && !f.to_s.include?(pattern)
+  INPUTS.each do |label, arg|
+    ns, min = run_case(f, arg, 1)
+    results << [f.to_s, label, ns, min]
+  end
+  batch = :"#{f}_all"
+  next unless CMath.respond_to?(batch)
+  buf = CMath::Buffer.new(Array.new(BATCH_SIZE) { |i| Complex(0.01 * i - 5, 0.003 * i - 1.5) })
+  ns, min = run_case(batch, buf, BATCH_SIZE)
+  results << [batch.to_s, "buffer_#{BATCH_SIZE}", ns, min]
+end
+
+if text
+  results.each do |f, label, ns, min|
+    puts format("%-14s %-16s %10.1f ns/call %14.0f calls/s  (min %.1f)", f, label, ns, 1e9 / ns, min)
+  end
+else
+  rows = results.map do |f, label, ns, min|
+    format('    {"function": "%s", "input": "%s", "ns_per_call": %.3f, "calls_per_sec": %.0f, "min_ns_per_call": %.3f}',
+           f, label, ns, 1e9 / ns, min)
+  end
+  puts "{"
+  puts '  "benchmark": "mruby-cmath-alt",'
+  puts "  \"repeat\": #{REPEAT},"
+  puts "  \"results\": ["
+  puts rows.join(",\n")
+  puts "  ]"
+  puts "}"
+end
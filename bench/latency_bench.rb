@@ -0,0 +1,98 @@
+##
+# Per-call latency of the CMath kernels whose cost depends on the
+# argument, run by the mruby-cmath-bench driver:
+#
+#   mruby-cmath-bench bench/latency_bench.rb [--text] [pattern]
+#
+# Every call is timed on its own, through name_into so that nothing is
+# allocated, over inputs that fall at random on either side of the
+# kernel's cutoffs.  The 50th, 99th and 99.9th percentiles are reported,
+# in nanoseconds and including the call overhead.  Compare a default
+# build with one made with CMATH_BRANCHLESS (`rake bench:latency
+# BRANCHLESS=1`).  Output is JSON on stdout unless --text is given.
+
+SAMPLES = 200_000
+WARMUP = 10_000
+
+# Deterministic xorshift, so that every build sees the same inputs
+class Xorshift
+  def initialize(seed)
+    @s = seed
+  end
+
+  # Uniform in [0, 1)
+  def next
+    @s ^= (@s << 13) & 0xffffffff
+    @s ^= @s >> 17
+    @s ^= (@s << 5) & 0xffffffff
+    @s.to_f / 4294967296.0
+  end
+
+  # Uniform in (-scale, scale)
+  def signed(scale)
+    (self.next * 2 - 1) * scale
+  end
+end
+
+# Each input class picks, per sample, one of the given scales for both parts
+INPUTS = {
+  sqrt: [
+    ["moderate", [1.0]],
+    ["scaled", [1.0, 1.0e308, 1.0e-308]],
+  ],
+  tanh: [
+    ["moderate", [1.0]],
+    ["cutoffs", [1.0, 30.0, 400.0]],
+  ],
+  asinh: [
+    ["moderate", [1.0]],
+    ["cutoff", [1.0, 1.0e9]],
+  ],
+}
+
+def percentile(sorted, p)
+  i = (sorted.size * p).ceil - 1
+  sorted[i < 0 ? 0 : i]
+end
+
+def inputs(scales, n)
+  rng = Xorshift.new(2463534242)
+  Array.new(n) do
+    scale = scales[(rng.next * scales.size).floor]
+    Complex(rng.signed(scale), rng.signed(scale))
+  end
+end
+
+text = ARGV.delete("--text")
+pattern = ARGV[0]
+
+buf = CMath::Buffer.new(1)
+results = []
+INPUTS.each do |f, classes|
+  next if pattern && !f.to_s.include?(pattern)
+  name = :"#{f}_into"
+  classes.each do |label, scales|
+    args = inputs(scales, SAMPLES)
+    Bench.latency(name, buf, args[0, WARMUP])
+    t = Bench.latency(name, buf, args).sort
+    results << [f.to_s, label, percentile(t, 0.5), percentile(t, 0.99), percentile(t, 0.999)]
+  end
+end
+
+if text
+  results.each do |f, label, p50, p99, p999|
+    puts format("%-8s %-10s p50 %6d ns  p99 %6d ns  p999 %6d ns", f, label, p50, p99, p999)
+  end
+else
+  rows = results.map do |f, label, p50, p99, p999|
+    format('    {"function": "%s", "input": "%s", "p50_ns": %d, "p99_ns": %d, "p999_ns": %d}',
+           f, label, p50, p99, p999)
+  end
+  puts "{"
+  puts '  "benchmark": "mruby-cmath-alt latency",'
+  puts "  \"samples\": #{SAMPLES},"
+  puts "  \"results\": ["
+  puts rows.join(",\n")
+  puts "  ]"
+  puts "}"
+end
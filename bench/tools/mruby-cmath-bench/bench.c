@@ -0,0 +1,143 @@
+/*
+** bench.c - driver for the CMath microbenchmarks
+**
+** See Copyright Notice in mruby.h
+*/
+
+/*
+** Usage: mruby-cmath-bench script.rb [args...]
+**
+** Runs script.rb with ARGV set to args and a Bench module providing
+**   Bench.clock_ns                  -> monotonic clock in nanoseconds
+**   Bench.measure(sym, arg, count)  -> nanoseconds taken by count calls
+**                                      of CMath.sym(arg)
+**   Bench.latency(sym, buf, inputs) -> Array of the nanoseconds taken
+**                                      by each call CMath.sym(buf, 0, x),
+**                                      for x in inputs
+** Bench.measure and Bench.latency make the calls from C, so the figures
+** do not include the cost of a Ruby-level loop.  Bench.latency is meant
+** for the name_into functions, which allocate nothing, so that garbage
+** collection does not show up in the tail.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/compile.h>
+#include <mruby/string.h>
+#include <mruby/variable.h>
+
+static mrb_int
+bench_clock_ns(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (mrb_int)ts.tv_sec*1000000000 + ts.tv_nsec;
+#else
+  return (mrb_int)((double)clock() * (1e9 / CLOCKS_PER_SEC));
+#endif
+}
+
+static mrb_value
+bench_clock(mrb_state *mrb, mrb_value self)
+{
+  return mrb_int_value(mrb, bench_clock_ns());
+}
+
+static mrb_value
+bench_measure(mrb_state *mrb, mrb_value self)
+{
+  mrb_sym name;
+  mrb_value arg, cmath;
+  mrb_int count, i, start;
+  int ai;
+
+  mrb_get_args(mrb, "noi", &name, &arg, &count);
+  cmath = mrb_obj_value(mrb_module_get(mrb, "CMath"));
+  ai = mrb_gc_arena_save(mrb);
+  start = bench_clock_ns();
+  for (i = 0; i < count; i++) {
+    mrb_funcall_argv(mrb, cmath, name, 1, &arg);
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  return mrb_int_value(mrb, bench_clock_ns() - start);
+}
+
+static mrb_value
+bench_latency(mrb_state *mrb, mrb_value self)
+{
+  mrb_sym name;
+  mrb_value buf, inputs, cmath, result, argv[3];
+  mrb_int i, n, start;
+  int ai;
+
+  mrb_get_args(mrb, "noA", &name, &buf, &inputs);
+  cmath = mrb_obj_value(mrb_module_get(mrb, "CMath"));
+  n = RARRAY_LEN(inputs);
+  result = mrb_ary_new_capa(mrb, n);
+  argv[0] = buf;
+  argv[1] = mrb_int_value(mrb, 0);
+  ai = mrb_gc_arena_save(mrb);
+  for (i = 0; i < n; i++) {
+    argv[2] = RARRAY_PTR(inputs)[i];
+    start = bench_clock_ns();
+    mrb_funcall_argv(mrb, cmath, name, 3, argv);
+    mrb_ary_push(mrb, result, mrb_int_value(mrb, bench_clock_ns() - start));
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  return result;
+}
+
+int
+main(int argc, char **argv)
+{
+  mrb_state *mrb;
+  struct RClass *bench;
+  mrb_value args;
+  mrbc_context *c;
+  FILE *fp;
+  int i, status = EXIT_SUCCESS;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s script.rb [args...]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  fp = fopen(argv[1], "r");
+  if (fp == NULL) {
+    perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+  mrb = mrb_open();
+  if (mrb == NULL) {
+    fprintf(stderr, "%s: cannot open mruby\n", argv[0]);
+    fclose(fp);
+    return EXIT_FAILURE;
+  }
+
+  bench = mrb_define_module(mrb, "Bench");
+  mrb_define_module_function(mrb, bench, "clock_ns", bench_clock, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, bench, "measure", bench_measure, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, bench, "latency", bench_latency, MRB_ARGS_REQ(3));
+
+  args = mrb_ary_new_capa(mrb, argc - 2);
+  for (i = 2; i < argc; i++) {
+    mrb_ary_push(mrb, args, mrb_str_new_cstr(mrb, argv[i]));
+  }
+  mrb_define_global_const(mrb, "ARGV", args);
+
+  c = mrbc_context_new(mrb);
+  mrbc_filename(mrb, c, argv[1]);
+  mrb_load_file_cxt(mrb, fp, c);
+  if (mrb->exc) {
+    mrb_print_error(mrb);
+    status = EXIT_FAILURE;
+  }
+  mrbc_context_free(mrb, c);
+  fclose(fp);
+  mrb_close(mrb);
+  return status;
+}
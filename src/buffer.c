@@ -0,0 +1,258 @@
+/*
+** buffer.c - CMath::Buffer, packed storage for complex values
+**
+** See Copyright Notice in mruby.h
+*/
+
+#include <string.h>
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include <mruby/string.h>
+#include "cmath.h"
+
+/* Drop one reference to buf, freeing it with the last one */
+void
+cmath_buffer_release(mrb_state *mrb, struct cmath_buffer *buf)
+{
+  if (buf && --buf->refs == 0) {
+    mrb_free(mrb, buf->ptr);
+    mrb_free(mrb, buf);
+  }
+}
+
+static void
+cmath_buffer_free(mrb_state *mrb, void *p)
+{
+  cmath_buffer_release(mrb, (struct cmath_buffer*)p);
+}
+
+static const struct mrb_data_type cmath_buffer_type = {
+  "CMath::Buffer", cmath_buffer_free,
+};
+
+static struct cmath_buffer*
+cmath_buffer_alloc(mrb_state *mrb, mrb_int len)
+{
+  struct cmath_buffer *buf;
+
+  if (len < 0) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "negative buffer size");
+  }
+  if ((size_t)len > SIZE_MAX / sizeof(mrb_complex)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "buffer size too big");
+  }
+  buf = (struct cmath_buffer*)mrb_malloc(mrb, sizeof(struct cmath_buffer));
+  buf->len = 0;
+  buf->ptr = NULL;
+  buf->refs = 1;
+  if (len > 0) {
+    buf->ptr = (mrb_complex*)mrb_malloc_simple(mrb, len * sizeof(mrb_complex));
+    if (buf->ptr == NULL) {
+      mrb_free(mrb, buf);
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "buffer size too big");
+    }
+    memset(buf->ptr, 0, len * sizeof(mrb_complex));
+  }
+  buf->len = len;
+  return buf;
+}
+
+struct cmath_buffer*
+cmath_buffer_get(mrb_state *mrb, mrb_value self)
+{
+  struct cmath_buffer *buf = DATA_GET_PTR(mrb, self, &cmath_buffer_type, struct cmath_buffer);
+
+  if (buf == NULL) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "uninitialized buffer");
+  }
+  return buf;
+}
+
+/* Raise unless buf may be written; a running CMath::Job may be reading it */
+void
+cmath_buffer_modify(mrb_state *mrb, struct cmath_buffer *buf)
+{
+  if (buf->refs > 1) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "buffer is in use by a CMath::Job");
+  }
+}
+
+mrb_value
+cmath_buffer_new(mrb_state *mrb, mrb_int len)
+{
+  struct RClass *c = mrb_class_get_under(mrb, mrb_module_get(mrb, "CMath"), "Buffer");
+  struct RData *d = mrb_data_object_alloc(mrb, c, NULL, &cmath_buffer_type);
+
+  d->data = cmath_buffer_alloc(mrb, len);
+  return mrb_obj_value(d);
+}
+
+mrb_bool
+cmath_buffer_p(mrb_state *mrb, mrb_value obj)
+{
+  return mrb_data_check_get_ptr(mrb, obj, &cmath_buffer_type) != NULL;
+}
+
+/* Index i of buf, counting negative i from the end; -1 if out of range */
+mrb_int
+cmath_buffer_index(struct cmath_buffer *buf, mrb_int i)
+{
+  if (i < 0) i += buf->len;
+  if (i < 0 || i >= buf->len) return -1;
+  return i;
+}
+
+/*
+ * Buffer.new(size)   -> buffer of size zeros
+ * Buffer.new(array)  -> buffer holding the Numeric elements of array
+ * Buffer.new(string) -> buffer holding the packed native-endian
+ *                       (real, imaginary) float pairs in string
+ */
+static mrb_value
+cmath_buffer_initialize(mrb_state *mrb, mrb_value self)
+{
+  mrb_value src = mrb_get_arg1(mrb);
+  struct cmath_buffer *buf = (struct cmath_buffer*)DATA_PTR(self);
+  mrb_int i;
+
+  if (buf) {
+    cmath_buffer_modify(mrb, buf);
+    cmath_buffer_free(mrb, buf);
+  }
+  mrb_data_init(self, NULL, &cmath_buffer_type);
+
+  if (mrb_integer_p(src)) {
+    buf = cmath_buffer_alloc(mrb, mrb_integer(src));
+    mrb_data_init(self, buf, &cmath_buffer_type);
+  }
+  else if (mrb_array_p(src)) {
+    buf = cmath_buffer_alloc(mrb, RARRAY_LEN(src));
+    mrb_data_init(self, buf, &cmath_buffer_type);
+    for (i = 0; i < buf->len && i < RARRAY_LEN(src); i++) {
+      mrb_float real, imag;
+      cmath_get_complex(mrb, mrb_ary_entry(src, i), &real, &imag);
+      buf->ptr[i] = cmath_build_complex(real, imag);
+    }
+  }
+  else if (mrb_string_p(src)) {
+    if (RSTRING_LEN(src) % sizeof(mrb_complex) != 0) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "string length is not a multiple of the element size");
+    }
+    buf = cmath_buffer_alloc(mrb, RSTRING_LEN(src) / sizeof(mrb_complex));
+    mrb_data_init(self, buf, &cmath_buffer_type);
+    if (buf->len > 0) {
+      memcpy(buf->ptr, RSTRING_PTR(src), buf->len * sizeof(mrb_complex));
+    }
+  }
+  else {
+    mrb_raise(mrb, E_TYPE_ERROR, "Integer, Array or String required");
+  }
+  return self;
+}
+
+static mrb_value
+cmath_buffer_init_copy(mrb_state *mrb, mrb_value copy)
+{
+  mrb_value src = mrb_get_arg1(mrb);
+  struct cmath_buffer *s, *buf;
+
+  if (mrb_obj_equal(mrb, copy, src)) return copy;
+  s = cmath_buffer_get(mrb, src);
+  buf = (struct cmath_buffer*)DATA_PTR(copy);
+  if (buf) {
+    cmath_buffer_modify(mrb, buf);
+    cmath_buffer_free(mrb, buf);
+  }
+  mrb_data_init(copy, NULL, &cmath_buffer_type);
+  buf = cmath_buffer_alloc(mrb, s->len);
+  mrb_data_init(copy, buf, &cmath_buffer_type);
+  if (buf->len > 0) {
+    memcpy(buf->ptr, s->ptr, buf->len * sizeof(mrb_complex));
+  }
+  return copy;
+}
+
+/* length: number of elements */
+static mrb_value
+cmath_buffer_length(mrb_state *mrb, mrb_value self)
+{
+  return mrb_int_value(mrb, cmath_buffer_get(mrb, self)->len);
+}
+
+/* buf[i]: element i as a Complex, or nil if out of range */
+static mrb_value
+cmath_buffer_aref(mrb_state *mrb, mrb_value self)
+{
+  struct cmath_buffer *buf = cmath_buffer_get(mrb, self);
+  mrb_int i;
+
+  mrb_get_args(mrb, "i", &i);
+  i = cmath_buffer_index(buf, i);
+  if (i < 0) return mrb_nil_value();
+  return mrb_complex_new(mrb, cmath_creal(buf->ptr[i]), cmath_cimag(buf->ptr[i]));
+}
+
+/* buf[i] = z: store the Numeric z into element i */
+static mrb_value
+cmath_buffer_aset(mrb_state *mrb, mrb_value self)
+{
+  struct cmath_buffer *buf = cmath_buffer_get(mrb, self);
+  mrb_int i, j;
+  mrb_value z;
+  mrb_float real, imag;
+
+  mrb_get_args(mrb, "io", &i, &z);
+  cmath_buffer_modify(mrb, buf);
+  j = cmath_buffer_index(buf, i);
+  if (j < 0) {
+    mrb_raisef(mrb, E_INDEX_ERROR, "index %i out of buffer", i);
+  }
+  cmath_get_complex(mrb, z, &real, &imag);
+  buf->ptr[j] = cmath_build_complex(real, imag);
+  return z;
+}
+
+/* to_a: Array of Complex */
+static mrb_value
+cmath_buffer_to_a(mrb_state *mrb, mrb_value self)
+{
+  struct cmath_buffer *buf = cmath_buffer_get(mrb, self);
+  mrb_value ary = mrb_ary_new_capa(mrb, buf->len);
+  int ai = mrb_gc_arena_save(mrb);
+  mrb_int i;
+
+  for (i = 0; i < buf->len; i++) {
+    mrb_ary_push(mrb, ary, mrb_complex_new(mrb, cmath_creal(buf->ptr[i]), cmath_cimag(buf->ptr[i])));
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  return ary;
+}
+
+/* dump: String of packed (real, imaginary) pairs, the inverse of Buffer.new(string) */
+static mrb_value
+cmath_buffer_dump(mrb_state *mrb, mrb_value self)
+{
+  struct cmath_buffer *buf = cmath_buffer_get(mrb, self);
+
+  return mrb_str_new(mrb, (const char*)buf->ptr, buf->len * sizeof(mrb_complex));
+}
+
+void
+cmath_buffer_init(mrb_state *mrb, struct RClass *cmath)
+{
+  struct RClass *buffer;
+
+  buffer = mrb_define_class_under(mrb, cmath, "Buffer", mrb->object_class);
+  MRB_SET_INSTANCE_TT(buffer, MRB_TT_CDATA);
+
+  mrb_define_method(mrb, buffer, "initialize", cmath_buffer_initialize, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, buffer, "initialize_copy", cmath_buffer_init_copy, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, buffer, "length", cmath_buffer_length, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "size", cmath_buffer_length, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "[]", cmath_buffer_aref, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, buffer, "[]=", cmath_buffer_aset, MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, buffer, "to_a", cmath_buffer_to_a, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "dump", cmath_buffer_dump, MRB_ARGS_NONE());
+}
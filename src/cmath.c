@@ -10,16 +10,13 @@
 ** You need a version of GCC that supports C99+.
 */
 
+#include <stdint.h>
+#include <string.h>
 #include <mruby.h>
+#include <mruby/array.h>
+#include "cmath.h"
 
-#ifdef MRB_NO_FLOAT
-# error CMath conflicts with 'MRB_NO_FLOAT' configuration
-#endif
-
-mrb_value mrb_complex_new(mrb_state *mrb, mrb_float real, mrb_float imag);
-void mrb_complex_get(mrb_state *mrb, mrb_value cpx, mrb_float*, mrb_float*);
-
-static mrb_bool
+mrb_bool
 cmath_get_complex(mrb_state *mrb, mrb_value c, mrb_float *r, mrb_float *i)
 {
   if (mrb_integer_p(c)) {
@@ -42,128 +39,125 @@ cmath_get_complex(mrb_state *mrb, mrb_value c, mrb_float *r, mrb_float *i)
   }
 }
 
-#ifdef MRB_USE_FLOAT32
-#define F(x) x##f
-#else
-#define F(x) x
-#endif
-
-#if defined(_WIN32) && !defined(__MINGW32__)
-
-#ifdef MRB_USE_FLOAT32
-typedef _Fcomplex mrb_complex;
-#else
-typedef _Dcomplex mrb_complex;
-#endif
-
-static mrb_complex
-CXDIVf(mrb_complex x, mrb_float y)
-{
-  return cmath_build_complex(cmath_creal(x)/y, cmath_cimag(x)/y);
+#define DEF_CMATH_METHOD(name) \
+static mrb_value \
+cmath_ ## name(mrb_state *mrb, mrb_value self)\
+{\
+  mrb_value z = mrb_get_arg1(mrb);\
+  mrb_float real, imag;\
+  if (cmath_get_complex(mrb, z, &real, &imag)) {\
+    mrb_complex c = cmath_build_complex(real,imag);\
+    CMATH_STAT(name, complex);\
+    c = cmath_c ## name(c);\
+    return mrb_complex_new(mrb, cmath_creal(c), cmath_cimag(c));\
+  }\
+  CMATH_STAT(name, real);\
+  return mrb_float_value(mrb, F(name)(real));\
 }
 
-static mrb_complex
-CXDIVc(mrb_complex a, mrb_complex b)
+/* sin(y) and cos(y), reducing y only once; see trig.c */
+static void
+cmath_real_sincos(mrb_float y, mrb_float *s, mrb_float *c)
 {
-  mrb_float ratio, den;
-  mrb_float abr, abi, cr, ci;
+  double sd, cd;
 
-  if ((abr = cmath_creal(b)) < 0)
-    abr = - abr;
-  if ((abi = cmath_cimag(b)) < 0)
-    abi = - abi;
-  if (abr <= abi) {
-    ratio = cmath_creal(b) / cmath_cimag(b);
-    den = cmath_cimag(a) * (1 + ratio*ratio);
-    cr = (cmath_creal(a)*ratio + cmath_cimag(a)) / den;
-    ci = (cmath_cimag(a)*ratio - cmath_creal(a)) / den;
-  }
-  else {
-    ratio = cmath_cimag(b) / cmath_creal(b);
-    den = cmath_creal(a) * (1 + ratio*ratio);
-    cr = (cmath_creal(a) + cmath_cimag(a)*ratio) / den;
-    ci = (cmath_cimag(a) - cmath_creal(a)*ratio) / den;
-  }
-  return cmath_build_complex(cr, ci);
+  cmath_trig_sincos(y, &sd, &cd);
+  *s = (mrb_float)sd;
+  *c = (mrb_float)cd;
 }
 
-#else
-
-#if defined(__cplusplus) && (defined(__APPLE__) || (defined(__clang__) && (defined(__FreeBSD__) || defined(__OpenBSD__))))
-
-#ifdef MRB_USE_FLOAT32
-typedef std::complex<float> mrb_complex;
-#else
-typedef std::complex<double> mrb_complex;
-#endif  /* MRB_USE_FLOAT32 */
-
-
-#else  /* cpp */
-
-#ifdef MRB_USE_FLOAT32
-typedef float _Complex mrb_complex;
-#else
-typedef double _Complex mrb_complex;
-#endif  /*  MRB_USE_FLOAT32 */
-
-static mrb_complex
-cmath_build_complex(mrb_float x, mrb_float y)
+/* sinh(x) and cosh(x) from a single exponential */
+static void
+cmath_real_sinhcosh(mrb_float x, mrb_float *s, mrb_float *c)
 {
-#ifdef __GNUC__
-  return __builtin_complex(x, y);
+#ifdef MRB_USE_FLOAT32
+  static const float cutoff1 = 9.0F;
+  static const float cutoff2 = 88.0F;
 #else
-  union { mrb_float r[2]; mrb_complex c; } u;
-
-  u.r[0] = x;
-  u.r[1] = y;
-  return u.c;
+  static const double cutoff1 = 22.0;
+  static const double cutoff2 = 709.0;
 #endif
+  mrb_float ax = F(fabs)(x);
+
+  if (ax < cutoff1) {
+    /* expm1 keeps sinh accurate near zero */
+    CMATH_STAT(real_sinhcosh, expm1);
+    mrb_float em = F(expm1)(ax);
+    mrb_float e = em + 1.0F;
+    *s = F(copysign)(0.5F*(em + em/e), x);
+    *c = 0.5F*e + 0.5F/e;
+  } else if (ax < cutoff2) {
+    /* Cutoff above which exp(-x) is lost against exp(x) */
+    CMATH_STAT(real_sinhcosh, exp);
+    mrb_float e = F(exp)(ax);
+    *s = F(copysign)(0.5F*e, x);
+    *c = 0.5F*e;
+  } else {
+    /* exp(x) would overflow before cosh(x) does */
+    CMATH_STAT(real_sinhcosh, half_exp);
+    mrb_float h = F(exp)(0.5F*ax);
+    *c = (0.5F*h)*h;
+    *s = F(copysign)(*c, x);
+  }
 }
 
-static mrb_float
-cmath_creal(mrb_complex c)
+#ifdef CMATH_BRANCHLESS
+/*
+ * With CMATH_BRANCHLESS, csqrt, ctanh and casinh evaluate every regime
+ * of a finite argument and keep one result with cmath_select, so that
+ * their cost does not depend on the argument.  The only branch left is
+ * the test for a NaN or infinite argument, which is well predicted when
+ * those are rare; the full kernels handle them as cmath_cxxx_special.
+ */
+
+/* c ? a : b, by masking the bits instead of branching */
+static inline mrb_float
+cmath_select(int c, mrb_float a, mrb_float b)
 {
-#ifdef __GNUC__
-  return __real__(c);
+#ifdef MRB_USE_FLOAT32
+  uint32_t ua, ub, mask;
 #else
-  union { mrb_float r[2]; mrb_complex c; } u;
-
-  u.c = c;
-  return u.r[0];
+  uint64_t ua, ub, mask;
 #endif
+
+  mask = -(__typeof__(mask))(c != 0);
+  memcpy(&ua, &a, sizeof(a));
+  memcpy(&ub, &b, sizeof(b));
+  ua = (ua & mask) | (ub & ~mask);
+  memcpy(&a, &ua, sizeof(a));
+  return a;
 }
 
-static mrb_float
-cmath_cimag(mrb_complex c)
-{
-#ifdef __GNUC__
-  return __imag__(c);
-#else
-  union { mrb_float r[2]; mrb_complex c; } u;
+#define CMATH_BRANCHING(name) cmath_c ## name ## _special
 
-  u.c = c;
-  return u.r[1];
-#endif
+#define DEF_CMATH_BRANCHLESS(name) \
+static mrb_complex \
+cmath_c ## name(mrb_complex c)\
+{\
+  mrb_float x = cmath_creal(c);\
+  mrb_float y = cmath_cimag(c);\
+  if (__builtin_expect((x - x) + (y - y) == 0.0F, 1)) {\
+    return cmath_c ## name ## _finite(c);\
+  }\
+  return cmath_c ## name ## _special(c);\
 }
+#else
+#define CMATH_BRANCHING(name) cmath_c ## name
 #endif
 
-#define CXDIVf(x,y) (x)/(y)
-#define CXDIVc(x,y) (x)/(y)
-
-#endif
+/*
+ * cmath_cxxx_finite(c) is the general branch of cmath_cxxx: it is only
+ * correct for finite c, but skips the special-value tests.  Batches
+ * whose elements are all finite call it directly.
+ */
 
-#define DEF_CMATH_METHOD(name) \
-static mrb_value \
-cmath_ ## name(mrb_state *mrb, mrb_value self)\
-{\
-  mrb_value z = mrb_get_arg1(mrb);\
-  mrb_float real, imag;\
-  if (cmath_get_complex(mrb, z, &real, &imag)) {\
-    mrb_complex c = cmath_build_complex(real,imag);\
-    c = cmath_c ## name(c);\
-    return mrb_complex_new(mrb, cmath_creal(c), cmath_cimag(c));\
-  }\
-  return mrb_float_value(mrb, F(name)(real));\
+static mrb_complex
+cmath_cexp_finite(mrb_complex c)
+{
+  mrb_float r = F(exp)(cmath_creal(c));
+  mrb_float sy, cy;
+  cmath_real_sincos(cmath_cimag(c), &sy, &cy);
+  return cmath_build_complex(r*cy, r*sy);
 }
 
 static mrb_complex
@@ -173,6 +167,7 @@ cmath_cexp(mrb_complex c)
   mrb_float y = cmath_cimag(c);
 
   if (isnan(x)) {
+    CMATH_STAT(exp, nan);
     if (y == 0.0F) {
       return cmath_build_complex(NAN, y);
     } else {
@@ -180,19 +175,36 @@ cmath_cexp(mrb_complex c)
     }
   }
   if (x == +INFINITY) {
+    CMATH_STAT(exp, inf);
     if (isnan(y) || isinf(y)) {
       return cmath_build_complex(+INFINITY, NAN);
     } else if (y == 0.0F) {
       return c;
     }
   } else if (x == -INFINITY) {
+    CMATH_STAT(exp, inf);
     if (isnan(y) || isinf(y)) {
       return cmath_build_complex(+0.0F, F(copysign)(0.0F, y));
     }
   }
 
-  mrb_float r = F(exp)(x);
-  return cmath_build_complex(r*F(cos)(y), r*F(sin)(y));
+  return cmath_cexp_finite(c);
+}
+
+/* cis(c) = exp(i*c); a real angle needs only sin and cos */
+static mrb_complex
+cmath_ccis(mrb_complex c)
+{
+  mrb_float x = cmath_creal(c);
+  mrb_float y = cmath_cimag(c);
+
+  if (y == 0.0F) {
+    mrb_float sx, cx;
+    CMATH_STAT(cis, real_angle);
+    cmath_real_sincos(x, &sx, &cx);
+    return cmath_build_complex(cx, sx);
+  }
+  return cmath_cexp(cmath_build_complex(-y, x));
 }
 
 static mrb_complex
@@ -206,12 +218,104 @@ cmath_clog(mrb_complex c)
 }
 
 static mrb_complex
-cmath_csqrt(mrb_complex c)
+cmath_clog10(mrb_complex c)
+{
+  return CXDIVf(cmath_clog(c),CMATH_LN10);
+}
+
+static mrb_complex
+cmath_clog2(mrb_complex c)
+{
+  return CXDIVf(cmath_clog(c),CMATH_LN2);
+}
+
+#ifdef CMATH_BRANCHLESS
+static mrb_complex
+cmath_csqrt_finite(mrb_complex c)
+{
+  /* The algebraic form below, with the scalings and the sign of x as selects */
+#ifdef MRB_USE_FLOAT32
+  static const float cutoff = 0x1p126F;
+  static const float tiny = 0x1p-124F;
+#else
+  static const double cutoff = 0x1p1022;
+  static const double tiny = 0x1p-1020;
+#endif
+  mrb_float x = cmath_creal(c);
+  mrb_float y = cmath_cimag(c);
+  int large = (F(fabs)(x) > cutoff) | (F(fabs)(y) > cutoff);
+  int small = (F(fabs)(x) < tiny) & (F(fabs)(y) < tiny);
+  mrb_float pre = cmath_select(large, 0.25F, cmath_select(small, 0x1p54F, 1.0F));
+  mrb_float scale = cmath_select(large, 2.0F, cmath_select(small, 0x1p-27F, 1.0F));
+
+  CMATH_STAT_ADD(sqrt, scale_large, large);
+  CMATH_STAT_ADD(sqrt, scale_tiny, small);
+  x *= pre;
+  y *= pre;
+  mrb_float r = F(hypot)(x, y);
+  mrb_float t = F(sqrt)((F(fabs)(x) + r) * 0.5F);
+  /* t is zero only for x == y == 0, where u must be y */
+  mrb_float u = y / (2.0F*cmath_select(t == 0.0F, 0.5F, t));
+  int neg = signbit(x) != 0;
+  return cmath_build_complex(cmath_select(neg, F(fabs)(u), t)*scale,
+                             cmath_select(neg, F(copysign)(t, y), u)*scale);
+}
+#else
+static mrb_complex
+cmath_csqrt_finite(mrb_complex c)
+{
+  /*
+   * Algebraic form: with t = sqrt((|x| + |c|)/2),
+   *   sqrt(c) = t + i*y/(2t)                 if x >= 0
+   *   sqrt(c) = |y|/(2t) + i*copysign(t, y)  if x < 0
+   * On the real axis this reduces to sqrt(|x|) exactly.
+   */
+#ifdef MRB_USE_FLOAT32
+  static const float cutoff = 0x1p126F;
+  static const float tiny = 0x1p-124F;
+#else
+  static const double cutoff = 0x1p1022;
+  static const double tiny = 0x1p-1020;
+#endif
+  mrb_float x = cmath_creal(c);
+  mrb_float y = cmath_cimag(c);
+  mrb_float scale = 1.0F;
+
+  if (x == 0.0F && y == 0.0F) {
+    return cmath_build_complex(0.0F, y);
+  }
+  if (F(fabs)(x) > cutoff || F(fabs)(y) > cutoff) {
+    /* Prevent hypot and |x| + |c| from overflowing */
+    CMATH_STAT(sqrt, scale_large);
+    x /= 4.0F;
+    y /= 4.0F;
+    scale = 2.0F;
+  } else if (F(fabs)(x) < tiny && F(fabs)(y) < tiny) {
+    /* Keep (|x| + |c|)/2 out of the subnormal range */
+    CMATH_STAT(sqrt, scale_tiny);
+    x *= 0x1p54F;
+    y *= 0x1p54F;
+    scale = 0x1p-27F;
+  }
+  mrb_float r = F(hypot)(x, y);
+  mrb_float t = F(sqrt)((F(fabs)(x) + r) * 0.5F);
+  mrb_float u = y / (2.0F*t);
+  if (signbit(x)) {
+    return cmath_build_complex(F(fabs)(u)*scale, F(copysign)(t, y)*scale);
+  } else {
+    return cmath_build_complex(t*scale, u*scale);
+  }
+}
+#endif
+
+static mrb_complex
+CMATH_BRANCHING(sqrt)(mrb_complex c)
 {
   mrb_float x = cmath_creal(c);
   mrb_float y = cmath_cimag(c);
 
   if (y == 0.0F) {
+    CMATH_STAT(sqrt, real_axis);
     if (isnan(x)) {
       return cmath_build_complex(x, x);
     } else if (signbit(x)) {
@@ -220,6 +324,9 @@ cmath_csqrt(mrb_complex c)
       return cmath_build_complex(F(sqrt)(+x), y);
     }
   } else {
+    if (isinf(x) || isinf(y)) {
+      CMATH_STAT(sqrt, special);
+    }
     if (isinf(x) && isinf(y)) {
       return cmath_build_complex(INFINITY, y);
     } else if (isinf(x) && isnan(y)) {
@@ -237,32 +344,31 @@ cmath_csqrt(mrb_complex c)
     } else if (isinf(y)) {
       return cmath_build_complex(INFINITY, y);
     } else {
-#ifdef MRB_USE_FLOAT32
-      static const float cutoff = 1e38;
-#else
-      static const double cutoff = 1e308;
-#endif
-      _Bool scale = (F(fabs)(x) > cutoff || (F(fabs)(y) > cutoff));
-      if (scale) {
-        /* Prevent hypot from overflowing */
-        x /= 4.0F;
-        y /= 4.0F;
-      }
-      mrb_float r = F(hypot)(x, y);
-      mrb_float t = F(atan2)(y, x);
-      r = F(sqrt)(r);
-      t /= 2.0F;
-      if (scale) {
-        r *= 2.0F;
-      }
-      return cmath_build_complex(r*F(cos)(t), r*F(sin)(t));
+      return cmath_csqrt_finite(c);
     }
   }
 }
 
+#ifdef CMATH_BRANCHLESS
+DEF_CMATH_BRANCHLESS(sqrt)
+#endif
+
 static mrb_complex cmath_csinh(mrb_complex c);
 static mrb_complex cmath_ccosh(mrb_complex c);
 static mrb_complex cmath_ctanh(mrb_complex c);
+static mrb_complex cmath_csinh_finite(mrb_complex c);
+static mrb_complex cmath_ccosh_finite(mrb_complex c);
+static mrb_complex cmath_ctanh_finite(mrb_complex c);
+
+static mrb_complex
+cmath_csin_finite(mrb_complex c)
+{
+  /* -i*csinh(i*c) */
+  mrb_complex ci = cmath_build_complex(-cmath_cimag(c), +cmath_creal(c));
+  mrb_complex di = cmath_csinh_finite(ci);
+  mrb_complex d = cmath_build_complex(+cmath_cimag(di), -cmath_creal(di));
+  return d;
+}
 
 static mrb_complex
 cmath_csin(mrb_complex c)
@@ -274,6 +380,15 @@ cmath_csin(mrb_complex c)
   return d;
 }
 
+static mrb_complex
+cmath_ccos_finite(mrb_complex c)
+{
+  /* ccosh(i*c) */
+  mrb_complex ci = cmath_build_complex(-cmath_cimag(c), +cmath_creal(c));
+  mrb_complex d = cmath_ccosh_finite(ci);
+  return d;
+}
+
 static mrb_complex
 cmath_ccos(mrb_complex c)
 {
@@ -283,6 +398,16 @@ cmath_ccos(mrb_complex c)
   return d;
 }
 
+static mrb_complex
+cmath_ctan_finite(mrb_complex c)
+{
+  /* -i*ctanh(i*c) */
+  mrb_complex ci = cmath_build_complex(-cmath_cimag(c), +cmath_creal(c));
+  mrb_complex di = cmath_ctanh_finite(ci);
+  mrb_complex d = cmath_build_complex(+cmath_cimag(di), -cmath_creal(di));
+  return d;
+}
+
 static mrb_complex
 cmath_ctan(mrb_complex c)
 {
@@ -293,11 +418,23 @@ cmath_ctan(mrb_complex c)
   return d;
 }
 
+static mrb_complex
+cmath_csinh_finite(mrb_complex c)
+{
+  mrb_float sx, cx, sy, cy;
+  cmath_real_sinhcosh(cmath_creal(c), &sx, &cx);
+  cmath_real_sincos(cmath_cimag(c), &sy, &cy);
+  return cmath_build_complex(sx*cy, cx*sy);
+}
+
 static mrb_complex
 cmath_csinh(mrb_complex c)
 {
   mrb_float x = cmath_creal(c);
   mrb_float y = cmath_cimag(c);
+  if (!isfinite(x) || !isfinite(y)) {
+    CMATH_STAT(sinh, special);
+  }
   if (isnan(x)) {
     if (isnan(y) || isinf(y)) {
       return cmath_build_complex(NAN, NAN);
@@ -310,28 +447,36 @@ cmath_csinh(mrb_complex c)
     } else if (y == 0.0F) {
       return cmath_build_complex(x, y);
     } else {
-      mrb_float cy = F(cos)(y);
-      mrb_float sy = F(sin)(y);
+      mrb_float sy, cy;
+      cmath_real_sincos(y, &sy, &cy);
       return cmath_build_complex(x*cy, INFINITY*sy);
     }
   } else {
     if (isnan(y) || isinf(y)) {
       return cmath_build_complex(x == 0.0F ? 0.0F : NAN, NAN);
     } else {
-      mrb_float cx = F(cosh)(x);
-      mrb_float sx = F(sinh)(x);
-      mrb_float cy = F(cos)(y);
-      mrb_float sy = F(sin)(y);
-      return cmath_build_complex(sx*cy, cx*sy);
+      return cmath_csinh_finite(c);
     }
   }
 }
 
+static mrb_complex
+cmath_ccosh_finite(mrb_complex c)
+{
+  mrb_float sx, cx, sy, cy;
+  cmath_real_sinhcosh(cmath_creal(c), &sx, &cx);
+  cmath_real_sincos(cmath_cimag(c), &sy, &cy);
+  return cmath_build_complex(cx*cy, sx*sy);
+}
+
 static mrb_complex
 cmath_ccosh(mrb_complex c)
 {
   mrb_float x = cmath_creal(c);
   mrb_float y = cmath_cimag(c);
+  if (!isfinite(x) || !isfinite(y)) {
+    CMATH_STAT(cosh, special);
+  }
   if (isnan(x)) {
     if (isnan(y) || isinf(y)) {
       return cmath_build_complex(NAN, NAN);
@@ -344,25 +489,87 @@ cmath_ccosh(mrb_complex c)
     } else if (y == 0.0F) {
       return cmath_build_complex(INFINITY, signbit(x) ? -y : +y);
     } else {
-      mrb_float cy = F(cos)(y);
-      mrb_float sy = F(sin)(y);
+      mrb_float sy, cy;
+      cmath_real_sincos(y, &sy, &cy);
       return cmath_build_complex(INFINITY*cy, x*sy);
     }
   } else {
     if (isnan(y) || isinf(y)) {
       return cmath_build_complex(NAN, x == 0.0F ? 0.0F : NAN);
     } else {
-      mrb_float cx = F(cosh)(x);
-      mrb_float sx = F(sinh)(x);
-      mrb_float cy = F(cos)(y);
-      mrb_float sy = F(sin)(y);
-      return cmath_build_complex(cx*cy, sx*sy);
+      return cmath_ccosh_finite(c);
     }
   }
 }
 
+/* csinh(c) and ccosh(c) together, sharing sinh/cosh(x) and sin/cos(y) */
+static void
+cmath_csinhcosh(mrb_complex c, mrb_complex *sh, mrb_complex *ch)
+{
+  mrb_float x = cmath_creal(c);
+  mrb_float y = cmath_cimag(c);
+  if (isfinite(x) && isfinite(y)) {
+    mrb_float sx, cx, sy, cy;
+    cmath_real_sinhcosh(x, &sx, &cx);
+    cmath_real_sincos(y, &sy, &cy);
+    *sh = cmath_build_complex(sx*cy, cx*sy);
+    *ch = cmath_build_complex(cx*cy, sx*sy);
+  } else {
+    *sh = cmath_csinh(c);
+    *ch = cmath_ccosh(c);
+  }
+}
+
+/* csin(c) and ccos(c) together */
+static void
+cmath_csincos(mrb_complex c, mrb_complex *s, mrb_complex *co)
+{
+  /* -i*csinh(i*c), ccosh(i*c) */
+  mrb_complex ci = cmath_build_complex(-cmath_cimag(c), +cmath_creal(c));
+  mrb_complex di;
+  cmath_csinhcosh(ci, &di, co);
+  *s = cmath_build_complex(+cmath_cimag(di), -cmath_creal(di));
+}
+
+#ifdef CMATH_BRANCHLESS
+static mrb_complex
+cmath_ctanh_finite(mrb_complex c)
+{
+  /*
+   * All three regimes below are evaluated, from one expm1 of |x|
+   * clamped to cutoff1.  Past cutoff2, cx*cx overflows and the full
+   * formula gives NaN, but its result is not the one selected.
+   */
+#ifdef MRB_USE_FLOAT32
+  static const float cutoff1 = 53.0F;
+  static const float cutoff2 = 0x1.0A2B24P+3F;
+#else
+  static const double cutoff1 = 373.0;
+  static const double cutoff2 = 0x1.3001004048044P+4;
+#endif
+  mrb_float x = cmath_creal(c);
+  mrb_float y = cmath_cimag(c);
+  mrb_float ax = F(fabs)(x);
+  int over1 = ax > cutoff1;
+  int over2 = ax > cutoff2;
+  mrb_float sy, cy;
+
+  CMATH_STAT_ADD(tanh, cutoff1, over1);
+  CMATH_STAT_ADD(tanh, cutoff2, over2 & !over1);
+  cmath_real_sincos(y, &sy, &cy);
+  mrb_float em = F(expm1)(cmath_select(over1, cutoff1, ax));
+  mrb_float e = em + 1.0F;
+  mrb_float sx = F(copysign)(0.5F*(em + em/e), x);
+  mrb_float cx = 0.5F*e + 0.5F/e;
+  mrb_float d = cx*cx*cy*cy + sx*sx*sy*sy;
+  /* Not (sy*cy)/(cx*cx); cx*cx might overflow */
+  mrb_float v2 = cmath_select(over1, 0.0F, sy*cy/cx/cx);
+  return cmath_build_complex(cmath_select(over2, F(copysign)(1.0F, x), sx*cx/d),
+                             cmath_select(over2, v2, sy*cy/d));
+}
+#else
 static mrb_complex
-cmath_ctanh(mrb_complex c)
+cmath_ctanh_finite(mrb_complex c)
 {
 #ifdef MRB_USE_FLOAT32
   static const float cutoff1 = 53.0F;
@@ -373,6 +580,35 @@ cmath_ctanh(mrb_complex c)
 #endif
   mrb_float x = cmath_creal(c);
   mrb_float y = cmath_cimag(c);
+  mrb_float sx, cx, sy, cy;
+
+  cmath_real_sincos(y, &sy, &cy);
+  if (F(fabs)(x) > cutoff1) {
+    /* Cutoff above which imag(w) == 0.0 */
+    CMATH_STAT(tanh, cutoff1);
+    return cmath_build_complex(F(copysign)(1.0F, x), 0.0F);
+  } else if (F(fabs)(x) > cutoff2) {
+    /* Cutoff above which |sx| == cx */
+    CMATH_STAT(tanh, cutoff2);
+    cmath_real_sinhcosh(x, &sx, &cx);
+    /* Not (sy*cy)/(cx*cx); cx*cx might overflow */
+    return cmath_build_complex(F(copysign)(1.0F, x), sy*cy/cx/cx);
+  } else {
+    cmath_real_sinhcosh(x, &sx, &cx);
+    mrb_float d = cx*cx*cy*cy + sx*sx*sy*sy;
+    return cmath_build_complex(sx*cx/d, sy*cy/d);
+  }
+}
+#endif
+
+static mrb_complex
+CMATH_BRANCHING(tanh)(mrb_complex c)
+{
+  mrb_float x = cmath_creal(c);
+  mrb_float y = cmath_cimag(c);
+  if (!isfinite(x) || !isfinite(y)) {
+    CMATH_STAT(tanh, special);
+  }
   if (isnan(x)) {
     if (isnan(y) || isinf(y)) {
       return cmath_build_complex(NAN, NAN);
@@ -390,48 +626,85 @@ cmath_ctanh(mrb_complex c)
     if (isnan(y) || isinf(y)) {
       return cmath_build_complex(x == 0.0F ? x : NAN, NAN);
     } else {
-      mrb_float cy = F(cos)(y);
-      mrb_float sy = F(sin)(y);
-      mrb_complex w;
-
-      if (F(fabs)(x) > cutoff1) {
-        /* Cutoff above which imag(w) == 0.0 */
-        w = cmath_build_complex(F(copysign)(1.0F, x), 0.0F);
-      } else if (F(fabs)(x) > cutoff2) {
-        /* Cutoff above which |sx| == cx */
-        mrb_float cx = F(cosh)(x);
-        /* Not (sy*cy)/(cx*cx); cx*cx might overflow */
-        w = cmath_build_complex(F(copysign)(1.0F, x), sy*cy/cx/cx);
-      } else {
-        mrb_float cx = F(cosh)(x);
-        mrb_float sx = F(sinh)(x);
-        mrb_float d = cx*cx*cy*cy + sx*sx*sy*sy;
-        w = cmath_build_complex(sx*cx/d, sy*cy/d);
-      }
-      return w;
+      return cmath_ctanh_finite(c);
     }
   }
 }
 
+#ifdef CMATH_BRANCHLESS
+DEF_CMATH_BRANCHLESS(tanh)
+#endif
+
+#ifdef CMATH_BRANCHLESS
 static mrb_complex
-cmath_casinh(mrb_complex c)
+cmath_casinh_finite(mrb_complex c)
+{
+  /*
+   * Both regimes below are evaluated on w = +c or -c, whichever has a
+   * nonnegative real part; the large regime squares zero instead of w,
+   * which might overflow.  w*w + 1 is written out, so the complex
+   * multiplication does not test its result for NaN; its imaginary part
+   * is qx*qy + qy*qx, as that multiplication rounds it, not 2*qx*qy,
+   * which rounds differently when the product is subnormal.
+   */
+  mrb_float x = cmath_creal(c);
+  mrb_float y = cmath_cimag(c);
+  mrb_float s = cmath_select(signbit(x) != 0, -1.0F, 1.0F);
+  int large = (F(fabs)(x) > 1e8F) | (F(fabs)(y) > 1e8F);
+  mrb_float wx = s*x;
+  mrb_float wy = s*y;
+  mrb_float qx = cmath_select(large, 0.0F, wx);
+  mrb_float qy = cmath_select(large, 0.0F, wy);
+
+  CMATH_STAT_ADD(asinh, large, large);
+  mrb_complex r = cmath_csqrt_finite(cmath_build_complex(qx*qx - qy*qy + 1.0F, qx*qy + qy*qx));
+  mrb_complex l = cmath_clog(cmath_build_complex(cmath_select(large, wx, wx + cmath_creal(r)),
+                                                 cmath_select(large, wy, wy + cmath_cimag(r))));
+  mrb_float lx = cmath_creal(l);
+  return cmath_build_complex(s*cmath_select(large, lx + CMATH_LN2, lx),
+                             s*cmath_cimag(l));
+}
+#else
+static mrb_complex
+cmath_casinh_finite(mrb_complex c)
+{
+  mrb_float x = cmath_creal(c);
+  mrb_float y = cmath_cimag(c);
+
+  if (F(fabs)(x) > 1e8F || F(fabs)(y) > 1e8F) {
+    /* Above this cutoff, c*c+1 == c*c; below it, c*c never overflows */
+    CMATH_STAT(asinh, large);
+    if (signbit(x)) {
+      return -(cmath_clog(-c) + CMATH_LN2);
+    } else {
+      return +(cmath_clog(+c) + CMATH_LN2);
+    }
+  } else {
+    if (signbit(x)) {
+      return -cmath_clog(-c + cmath_csqrt_finite(c*c + 1.0F));
+    } else {
+      return +cmath_clog(+c + cmath_csqrt_finite(c*c + 1.0F));
+    }
+  }
+}
+#endif
+
+static mrb_complex
+CMATH_BRANCHING(asinh)(mrb_complex c)
 {
   mrb_float x = cmath_creal(c);
   mrb_float y = cmath_cimag(c);
 
   if (isnan(x)) {
+    CMATH_STAT(asinh, special);
     if (isnan(y) || isinf(y)) {
       return cmath_build_complex(y, NAN);
     } else {
       return cmath_build_complex(NAN, y == 0.0F ? y : NAN);
     }
   } else if (F(fabs)(x) > 1e8F || F(fabs)(y) > 1e8F) {
-    /* Above this cutoff, c*c+1 == c*c; below it, c*c never overflows */
-    if (signbit(x)) {
-      return -(cmath_clog(-c) + (mrb_float)0.69314718055994530942);
-    } else {
-      return +(cmath_clog(+c) + (mrb_float)0.69314718055994530942);
-    }
+    /* Infinities land here too */
+    return cmath_casinh_finite(c);
   } else {
     if (signbit(x)) {
       return -cmath_clog(-c + cmath_csqrt(c*c + 1.0F));
@@ -441,6 +714,25 @@ cmath_casinh(mrb_complex c)
   }
 }
 
+#ifdef CMATH_BRANCHLESS
+DEF_CMATH_BRANCHLESS(asinh)
+#endif
+
+static mrb_complex
+cmath_cacosh_finite(mrb_complex c)
+{
+  mrb_float x = cmath_creal(c);
+  mrb_float y = cmath_cimag(c);
+
+  if (F(fabs)(x) > 1e8F || F(fabs)(y) > 1e8F) {
+    /* Above this cutoff, c*c-1 == c*c; below it, c*c never overflows */
+    CMATH_STAT(acosh, large);
+    return cmath_clog(c) + CMATH_LN2;
+  } else {
+    return cmath_clog(c + cmath_csqrt_finite(c + 1.0F)*cmath_csqrt_finite(c - 1.0F));
+  }
+}
+
 static mrb_complex
 cmath_cacosh(mrb_complex c)
 {
@@ -448,26 +740,52 @@ cmath_cacosh(mrb_complex c)
   mrb_float y = cmath_cimag(c);
 
   if (x == 0.0F && isnan(y)) {
-    return cmath_build_complex(NAN, (mrb_float)1.57079632679489661923);
+    CMATH_STAT(acosh, special);
+    return cmath_build_complex(NAN, CMATH_PI_2);
   } else if (F(fabs)(x) > 1e8F || F(fabs)(y) > 1e8F) {
-    /* Above this cutoff, c*c-1 == c*c; below it, c*c never overflows */
-    return cmath_clog(c) + (mrb_float)0.69314718055994530942;
+    /* Infinities land here too */
+    return cmath_cacosh_finite(c);
   } else {
     return cmath_clog(c + cmath_csqrt(c + 1.0F)*cmath_csqrt(c - 1.0F));
   }
 }
 
+static mrb_complex
+cmath_catanh_finite(mrb_complex c)
+{
+  mrb_float x = cmath_creal(c);
+  mrb_float y = cmath_cimag(c);
+
+  if (x == 0.0F) {
+    CMATH_STAT(atanh, imag_axis);
+    return cmath_build_complex(x, F(atan)(y));
+  } else if (y == 0.0F) {
+    CMATH_STAT(atanh, real_axis);
+    mrb_float q = (1.0F + x)/(1.0F - x);
+    if (signbit(q)) {
+      return cmath_build_complex(0.5F*F(log)(-q), F(copysign)(CMATH_PI_2, y));
+    } else {
+      return cmath_build_complex(0.5F*F(log)(+q), y);
+    }
+  } else {
+    return 0.5F*cmath_clog((1.0F + c)/(1.0F - c));
+  }
+}
+
 static mrb_complex
 cmath_catanh(mrb_complex c)
 {
   mrb_float x = cmath_creal(c);
   mrb_float y = cmath_cimag(c);
 
+  if (!isfinite(x) || !isfinite(y)) {
+    CMATH_STAT(atanh, special);
+  }
   if (isnan(x)) {
     if (isnan(y)) {
       return c;
     } else if (isinf(y)) {
-      return cmath_build_complex(0.0F, F(copysign)((mrb_float)1.57079632679489661923, y));
+      return cmath_build_complex(0.0F, F(copysign)(CMATH_PI_2, y));
     } else {
       return cmath_build_complex(x, NAN);
     }
@@ -475,30 +793,32 @@ cmath_catanh(mrb_complex c)
     if (isnan(y)) {
       return cmath_build_complex(F(copysign)(0.0F, x), NAN);
     } else {
-      return cmath_build_complex(F(copysign)(0.0F, x), F(copysign)((mrb_float)1.57079632679489661923, y));
+      return cmath_build_complex(F(copysign)(0.0F, x), F(copysign)(CMATH_PI_2, y));
     }
   } else {
     if (isnan(y)) {
       return cmath_build_complex(x == 0.0F ? x : NAN, y);
     } else if (isinf(y)) {
-      return cmath_build_complex(F(copysign)(0.0F, x), F(copysign)((mrb_float)1.57079632679489661923, y));
+      return cmath_build_complex(F(copysign)(0.0F, x), F(copysign)(CMATH_PI_2, y));
     } else {
-      if (x == 0.0F) {
-        return cmath_build_complex(x, F(atan)(y));
-      } else if (y == 0.0F) {
-        mrb_float q = (1.0F + x)/(1.0F - x);
-        if (signbit(q)) {
-          return cmath_build_complex(0.5F*F(log)(-q), F(copysign)((mrb_float)1.57079632679489661923, y));
-        } else {
-          return cmath_build_complex(0.5F*F(log)(+q), y);
-        }
-      } else {
-        return 0.5F*cmath_clog((1.0F + c)/(1.0F - c));
-      }
+      return cmath_catanh_finite(c);
     }
   }
 }
 
+static mrb_complex
+cmath_casin_finite(mrb_complex c)
+{
+  /* -i*asinh(i*c) */
+  mrb_float x1 = cmath_creal(c);
+  mrb_float y1 = cmath_cimag(c);
+  mrb_complex c2 = cmath_build_complex(-y1, +x1);
+  mrb_complex d2 = cmath_casinh_finite(c2);
+  mrb_float x2 = cmath_creal(d2);
+  mrb_float y2 = cmath_cimag(d2);
+  return cmath_build_complex(+y2, -x2);
+}
+
 static mrb_complex
 cmath_casin(mrb_complex c)
 {
@@ -512,6 +832,25 @@ cmath_casin(mrb_complex c)
   return cmath_build_complex(+y2, -x2);
 }
 
+/* -i*acosh(d2), on the principal branch */
+static mrb_complex
+cmath_cacos_from_acosh(mrb_complex d2)
+{
+  mrb_float x2 = cmath_creal(d2);
+  mrb_float y2 = cmath_cimag(d2);
+  mrb_complex d = cmath_build_complex(+y2, -x2);
+  if (signbit(cmath_creal(d))) {
+    d = -d;
+  }
+  return d;
+}
+
+static mrb_complex
+cmath_cacos_finite(mrb_complex c)
+{
+  return cmath_cacos_from_acosh(cmath_cacosh_finite(c));
+}
+
 static mrb_complex
 cmath_cacos(mrb_complex c)
 {
@@ -520,18 +859,23 @@ cmath_cacos(mrb_complex c)
   if (isnan(x1) && isinf(y1)) {
     return cmath_build_complex(NAN, -y1);
   } else {
-    /* -i*acosh(c) */
-    mrb_complex d2 = cmath_cacosh(c);
-    mrb_float x2 = cmath_creal(d2);
-    mrb_float y2 = cmath_cimag(d2);
-    mrb_complex d = cmath_build_complex(+y2, -x2);
-    if (signbit(cmath_creal(d))) {
-      d = -d;
-    }
-    return d;
+    return cmath_cacos_from_acosh(cmath_cacosh(c));
   }
 }
 
+static mrb_complex
+cmath_catan_finite(mrb_complex c)
+{
+  /* -i*atanh(i*c) */
+  mrb_float x1 = cmath_creal(c);
+  mrb_float y1 = cmath_cimag(c);
+  mrb_complex c2 = cmath_build_complex(-y1, +x1);
+  mrb_complex d2 = cmath_catanh_finite(c2);
+  mrb_float x2 = cmath_creal(d2);
+  mrb_float y2 = cmath_cimag(d2);
+  return cmath_build_complex(+y2, -x2);
+}
+
 static mrb_complex
 cmath_catan(mrb_complex c)
 {
@@ -548,6 +892,57 @@ cmath_catan(mrb_complex c)
 /* exp(z): return the exponential of z */
 DEF_CMATH_METHOD(exp)
 
+/*
+ * The logarithms of the last few bases given to CMath.log, so that a
+ * loop over z with a fixed base takes no clog of the base per call.
+ * Results are still divided by log(base), not multiplied by its
+ * reciprocal, which would make CMath.log(8, 2) come out just under 3.
+ */
+#define CMATH_LOG_BASES 4
+
+struct cmath_log_base {
+  mrb_float base;
+  mrb_complex log;              /* clog(base) */
+};
+
+static CMATH_THREAD_LOCAL struct {
+  struct cmath_log_base bases[CMATH_LOG_BASES];
+  int used;                     /* entries filled */
+  int next;                     /* entry to replace next */
+} cmath_log_memo;
+
+static const struct cmath_log_base*
+cmath_log_base(mrb_float base)
+{
+  struct cmath_log_base *b;
+  int i;
+
+  /* Compare the bits: -0.0 is a different base from +0.0 */
+  for (i = 0; i < cmath_log_memo.used; i++) {
+    if (memcmp(&cmath_log_memo.bases[i].base, &base, sizeof(base)) == 0) {
+      return &cmath_log_memo.bases[i];
+    }
+  }
+  b = &cmath_log_memo.bases[cmath_log_memo.next];
+  cmath_log_memo.next = (cmath_log_memo.next + 1) % CMATH_LOG_BASES;
+  if (cmath_log_memo.used < CMATH_LOG_BASES) cmath_log_memo.used++;
+  b->base = base;
+  b->log = cmath_clog(cmath_build_complex(base, 0.0F));
+  return b;
+}
+
+/* c/clog(base), given c = clog(z) */
+static mrb_complex
+cmath_clog_base(mrb_complex c, const struct cmath_log_base *b)
+{
+  if (b->base > 0.0F) {
+    mrb_float l = cmath_creal(b->log);
+
+    return cmath_build_complex(cmath_creal(c)/l, cmath_cimag(c)/l);
+  }
+  return CXDIVc(c, b->log);
+}
+
 /* log(z): return the natural logarithm of z, with branch cut along the negative real axis */
 static mrb_value
 cmath_log(mrb_state *mrb, mrb_value self) {
@@ -557,18 +952,17 @@ cmath_log(mrb_state *mrb, mrb_value self) {
 
   mrb_int n = mrb_get_args(mrb, "o|f", &z, &base);
 
-#ifndef M_E
-#define M_E F(exp)(1.0)
-#endif
-
-  if (n == 1) base = M_E;
+  if (n == 1) base = CMATH_E;
   if (cmath_get_complex(mrb, z, &real, &imag) || real < 0.0) {
     mrb_complex c = cmath_build_complex(real,imag);
+    CMATH_STAT(log, complex);
     c = cmath_clog(c);
-    if (n == 2) c = CXDIVc(c, cmath_clog(cmath_build_complex(base,0)));
+    if (n == 2) c = cmath_clog_base(c, cmath_log_base(base));
     return mrb_complex_new(mrb, cmath_creal(c), cmath_cimag(c));
   }
+  CMATH_STAT(log, real);
   if (n == 1) return mrb_float_value(mrb, F(log)(real));
+  if (base > 0.0F) return mrb_float_value(mrb, F(log)(real)/cmath_creal(cmath_log_base(base)->log));
   return mrb_float_value(mrb, F(log)(real)/F(log)(base));
 }
 
@@ -579,9 +973,11 @@ cmath_log10(mrb_state *mrb, mrb_value self) {
   mrb_float real, imag;
   if (cmath_get_complex(mrb, z, &real, &imag) || real < 0.0) {
     mrb_complex c = cmath_build_complex(real,imag);
-    c = CXDIVf(cmath_clog(c),log(10));
+    CMATH_STAT(log10, complex);
+    c = cmath_clog10(c);
     return mrb_complex_new(mrb, cmath_creal(c), cmath_cimag(c));
   }
+  CMATH_STAT(log10, real);
   return mrb_float_value(mrb, F(log10)(real));
 }
 
@@ -592,9 +988,11 @@ cmath_log2(mrb_state *mrb, mrb_value self) {
   mrb_float real, imag;
   if (cmath_get_complex(mrb, z, &real, &imag) || real < 0.0) {
     mrb_complex c = cmath_build_complex(real,imag);
-    c = CXDIVf(cmath_clog(c),log(2.0));
+    CMATH_STAT(log2, complex);
+    c = cmath_clog2(c);
     return mrb_complex_new(mrb, cmath_creal(c), cmath_cimag(c));
   }
+  CMATH_STAT(log2, real);
   return mrb_float_value(mrb, F(log2)(real));
 }
 
@@ -605,12 +1003,29 @@ cmath_sqrt(mrb_state *mrb, mrb_value self) {
   mrb_float real, imag;
   if (cmath_get_complex(mrb, z, &real, &imag) || real < 0.0) {
     mrb_complex c = cmath_build_complex(real,imag);
+    CMATH_STAT(sqrt, complex);
     c = cmath_csqrt(c);
     return mrb_complex_new(mrb, cmath_creal(c), cmath_cimag(c));
   }
+  CMATH_STAT(sqrt, real);
   return mrb_float_value(mrb, F(sqrt)(real));
 }
 
+/* cis(theta): cos(theta) + i*sin(theta), that is exp(i*theta) */
+static mrb_value
+cmath_cis(mrb_state *mrb, mrb_value self) {
+  mrb_value z = mrb_get_arg1(mrb);
+  mrb_float real, imag;
+  mrb_complex c;
+  if (cmath_get_complex(mrb, z, &real, &imag)) {
+    CMATH_STAT(cis, complex);
+  } else {
+    CMATH_STAT(cis, real);
+  }
+  c = cmath_ccis(cmath_build_complex(real,imag));
+  return mrb_complex_new(mrb, cmath_creal(c), cmath_cimag(c));
+}
+
 /* sin(z): sine function */
 DEF_CMATH_METHOD(sin)
 /* cos(z): cosine function */
@@ -636,12 +1051,488 @@ DEF_CMATH_METHOD(acosh)
 /* atanh(z): inverse hyperbolic tangent function */
 DEF_CMATH_METHOD(atanh)
 
+/* ------------------------------------------------------------------------*/
+/* Batch forms: name_all(ary) maps a function over an Array of Numeric,
+   or over a CMath::Buffer giving a new Buffer */
+
+/* Real arguments for which a function has a real result */
+#define CMATH_REAL_ALL    0
+#define CMATH_REAL_NONNEG 1
+#define CMATH_REAL_NONE   2
+
+struct cmath_func {
+  cmath_cfunc *cfunc;     /* complex kernel */
+  cmath_rfunc *rfunc;     /* real kernel */
+  cmath_vfunc *vfunc;     /* vectorized complex kernel, or NULL */
+  cmath_cfunc *ffunc;     /* complex kernel for finite arguments only, or NULL */
+  int real_domain;        /* CMATH_REAL_* */
+  int stat;               /* CMATH_STAT_<name>_real; <name>_complex follows */
+};
+
+static mrb_value
+cmath_apply(mrb_state *mrb, const struct cmath_func *f, mrb_value z)
+{
+  mrb_float real, imag;
+  if (cmath_get_complex(mrb, z, &real, &imag) || f->real_domain == CMATH_REAL_NONE ||
+      (f->real_domain == CMATH_REAL_NONNEG && real < 0.0)) {
+    mrb_complex c = cmath_build_complex(real,imag);
+    CMATH_STAT_ADD_ID(f->stat + 1, 1);
+    c = f->cfunc(c);
+    return mrb_complex_new(mrb, cmath_creal(c), cmath_cimag(c));
+  }
+  CMATH_STAT_ADD_ID(f->stat, 1);
+  return mrb_float_value(mrb, f->rfunc(real));
+}
+
+static mrb_value
+cmath_map_array(mrb_state *mrb, const struct cmath_func *f, mrb_value ary)
+{
+  mrb_value result = mrb_ary_new_capa(mrb, RARRAY_LEN(ary));
+  int ai = mrb_gc_arena_save(mrb);
+  mrb_int i;
+
+  for (i = 0; i < RARRAY_LEN(ary); i++) {
+    mrb_ary_push(mrb, result, cmath_apply(mrb, f, mrb_ary_entry(ary, i)));
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  return result;
+}
+
+/* Elements classified at a time when looking for a finite-only run */
+#define CMATH_BLOCK 64
+
+/* Whether every element is finite, in one branch-free sweep */
+static mrb_bool
+cmath_block_finite(const mrb_complex *src, mrb_int n)
+{
+  const mrb_float *p = (const mrb_float*)src;
+  int bad = 0;
+  mrb_int i;
+
+  for (i = 0; i < 2*n; i++) {
+    /* x - x is NaN for NaN and infinite x */
+    bad |= !(p[i] - p[i] == 0.0F);
+  }
+  return !bad;
+}
+
+struct cmath_batch {
+  const struct cmath_func *f;
+  mrb_complex *dst;
+  const mrb_complex *src;
+};
+
+static void
+cmath_batch_run(void *arg, mrb_int begin, mrb_int end)
+{
+  const struct cmath_batch *b = (const struct cmath_batch*)arg;
+  const struct cmath_func *f = b->f;
+  mrb_int i;
+
+  if (f->vfunc) {
+    f->vfunc(b->dst + begin, b->src + begin, end - begin, f->cfunc);
+    return;
+  }
+  if (f->ffunc) {
+    /* Blocks without special values skip the special-value tests */
+    for (i = begin; i < end; i += CMATH_BLOCK) {
+      mrb_int m = end - i < CMATH_BLOCK ? end - i : CMATH_BLOCK;
+      cmath_cfunc *k = cmath_block_finite(b->src + i, m) ? f->ffunc : f->cfunc;
+      mrb_int j;
+
+      for (j = i; j < i + m; j++) {
+        b->dst[j] = k(b->src[j]);
+      }
+    }
+    return;
+  }
+  for (i = begin; i < end; i++) {
+    b->dst[i] = f->cfunc(b->src[i]);
+  }
+}
+
+/* Large batches are split across the worker pool */
+void
+cmath_apply_buffer(const struct cmath_func *f, mrb_complex *dst, const mrb_complex *src, mrb_int n)
+{
+  struct cmath_batch b;
+
+  b.f = f;
+  b.dst = dst;
+  b.src = src;
+  cmath_parallel_for(n, cmath_batch_run, &b);
+}
+
+static mrb_value
+cmath_map(mrb_state *mrb, const struct cmath_func *f, mrb_value z)
+{
+  if (cmath_buffer_p(mrb, z)) {
+    struct cmath_buffer *src = cmath_buffer_get(mrb, z);
+    mrb_value result = cmath_buffer_new(mrb, src->len);
+    struct cmath_buffer *dst = cmath_buffer_get(mrb, result);
+
+    CMATH_STAT_ADD_ID(f->stat + 1, src->len);
+    cmath_apply_buffer(f, dst->ptr, src->ptr, src->len);
+    return result;
+  }
+  if (!mrb_array_p(z)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "Array or CMath::Buffer required");
+  }
+  return cmath_map_array(mrb, f, z);
+}
+
+/* name_into(buf, i, z): store name(z) into buf[i] without allocating */
+static mrb_value
+cmath_store(mrb_state *mrb, const struct cmath_func *f)
+{
+  mrb_value dest, z;
+  mrb_int i, j;
+  mrb_float real, imag;
+  struct cmath_buffer *buf;
+
+  mrb_get_args(mrb, "oio", &dest, &i, &z);
+  buf = cmath_buffer_get(mrb, dest);
+  cmath_buffer_modify(mrb, buf);
+  j = cmath_buffer_index(buf, i);
+  if (j < 0) {
+    mrb_raisef(mrb, E_INDEX_ERROR, "index %i out of buffer", i);
+  }
+  cmath_get_complex(mrb, z, &real, &imag);
+  CMATH_STAT_ADD_ID(f->stat + 1, 1);
+  buf->ptr[j] = f->cfunc(cmath_build_complex(real, imag));
+  return dest;
+}
+
+/* buf.name!: replace every element of buf with name(element) */
+static mrb_value
+cmath_map_inplace(mrb_state *mrb, const struct cmath_func *f, mrb_value self)
+{
+  struct cmath_buffer *buf = cmath_buffer_get(mrb, self);
+
+  cmath_buffer_modify(mrb, buf);
+  CMATH_STAT_ADD_ID(f->stat + 1, buf->len);
+  cmath_apply_buffer(f, buf->ptr, buf->ptr, buf->len);
+  return self;
+}
+
+#ifdef CMATH_VECTOR
+#define CMATH_VFUNC(name) cmath_v ## name
+#else
+#define CMATH_VFUNC(name) NULL
+#endif
+
+#define DEF_CMATH_BATCH(name, vfunc, ffunc, real_domain) \
+static const struct cmath_func cmath_func_ ## name = {\
+  cmath_c ## name, F(name), vfunc, ffunc, real_domain, CMATH_STAT_ ## name ## _real\
+};\
+static mrb_value \
+cmath_ ## name ## _all(mrb_state *mrb, mrb_value self)\
+{\
+  return cmath_map(mrb, &cmath_func_ ## name, mrb_get_arg1(mrb));\
+}\
+static mrb_value \
+cmath_ ## name ## _into(mrb_state *mrb, mrb_value self)\
+{\
+  return cmath_store(mrb, &cmath_func_ ## name);\
+}\
+static mrb_value \
+cmath_buffer_ ## name ## _bang(mrb_state *mrb, mrb_value self)\
+{\
+  return cmath_map_inplace(mrb, &cmath_func_ ## name, self);\
+}
+
+DEF_CMATH_BATCH(exp, CMATH_VFUNC(exp), cmath_cexp_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(log, NULL, NULL, CMATH_REAL_NONNEG)
+DEF_CMATH_BATCH(log10, NULL, NULL, CMATH_REAL_NONNEG)
+DEF_CMATH_BATCH(log2, NULL, NULL, CMATH_REAL_NONNEG)
+DEF_CMATH_BATCH(sqrt, NULL, cmath_csqrt_finite, CMATH_REAL_NONNEG)
+DEF_CMATH_BATCH(sin, CMATH_VFUNC(sin), cmath_csin_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(cos, CMATH_VFUNC(cos), cmath_ccos_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(tan, NULL, cmath_ctan_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(asin, NULL, cmath_casin_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(acos, NULL, cmath_cacos_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(atan, NULL, cmath_catan_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(sinh, CMATH_VFUNC(sinh), cmath_csinh_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(cosh, CMATH_VFUNC(cosh), cmath_ccosh_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(tanh, NULL, cmath_ctanh_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(asinh, NULL, cmath_casinh_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(acosh, NULL, cmath_cacosh_finite, CMATH_REAL_ALL)
+DEF_CMATH_BATCH(atanh, NULL, cmath_catanh_finite, CMATH_REAL_ALL)
+
+static const struct cmath_func cmath_func_cis = {
+  cmath_ccis, NULL, CMATH_VFUNC(cis), NULL, CMATH_REAL_NONE, CMATH_STAT_cis_real
+};
+static mrb_value
+cmath_cis_all(mrb_state *mrb, mrb_value self)
+{
+  return cmath_map(mrb, &cmath_func_cis, mrb_get_arg1(mrb));
+}
+static mrb_value
+cmath_cis_into(mrb_state *mrb, mrb_value self)
+{
+  return cmath_store(mrb, &cmath_func_cis);
+}
+static mrb_value
+cmath_buffer_cis_bang(mrb_state *mrb, mrb_value self)
+{
+  return cmath_map_inplace(mrb, &cmath_func_cis, self);
+}
+
+/*
+ * log(z, base) for a fixed base.  A positive base divides clog(z) by its
+ * real log, as CMath.log does, so that results such as log_all([8], 2)
+ * stay exact; any other multiplies by the reciprocal of clog(base).
+ */
+struct cmath_log_batch {
+  mrb_complex *dst;
+  const mrb_complex *src;
+  mrb_bool real_base;     /* base > 0: divide by lr */
+  mrb_float lr;
+  mrb_complex cinv;       /* otherwise multiply by cinv */
+};
+
+static void
+cmath_log_batch_init(struct cmath_log_batch *b, mrb_float real, mrb_float imag)
+{
+  mrb_complex l = cmath_clog(cmath_build_complex(real, imag));
+
+  b->real_base = imag == 0.0F && real > 0.0F;
+  b->lr = cmath_creal(l);
+  if (!b->real_base) b->cinv = CXDIVc(cmath_build_complex(1.0F, 0.0F), l);
+}
+
+static mrb_complex
+cmath_log_batch_apply(const struct cmath_log_batch *b, mrb_complex c)
+{
+  c = cmath_clog(c);
+  if (b->real_base) {
+    return cmath_build_complex(cmath_creal(c)/b->lr, cmath_cimag(c)/b->lr);
+  }
+  return c*b->cinv;
+}
+
+static void
+cmath_log_batch_run(void *arg, mrb_int begin, mrb_int end)
+{
+  const struct cmath_log_batch *b = (const struct cmath_log_batch*)arg;
+  mrb_int i;
+
+  for (i = begin; i < end; i++) {
+    b->dst[i] = cmath_log_batch_apply(b, b->src[i]);
+  }
+}
+
+/*
+ * log_all(z, base = E): log(z, base) for every element of an Array or
+ * CMath::Buffer, returned in the same kind of container.  The base may
+ * be real or complex; its logarithm is taken once.
+ */
+static mrb_value
+cmath_log_base_all(mrb_state *mrb, mrb_value self)
+{
+  mrb_value z, base, result;
+  mrb_float real, imag;
+  struct cmath_log_batch b;
+  mrb_int i;
+  int ai;
+
+  if (mrb_get_args(mrb, "o|o", &z, &base) == 1) {
+    return cmath_log_all(mrb, self);
+  }
+  cmath_get_complex(mrb, base, &real, &imag);
+  cmath_log_batch_init(&b, real, imag);
+
+  if (cmath_buffer_p(mrb, z)) {
+    struct cmath_buffer *src = cmath_buffer_get(mrb, z);
+
+    result = cmath_buffer_new(mrb, src->len);
+    b.dst = cmath_buffer_get(mrb, result)->ptr;
+    b.src = src->ptr;
+    CMATH_STAT_ADD(log, complex, src->len);
+    cmath_parallel_for(src->len, cmath_log_batch_run, &b);
+    return result;
+  }
+  if (!mrb_array_p(z)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "Array or CMath::Buffer required");
+  }
+  result = mrb_ary_new_capa(mrb, RARRAY_LEN(z));
+  ai = mrb_gc_arena_save(mrb);
+  for (i = 0; i < RARRAY_LEN(z); i++) {
+    if (cmath_get_complex(mrb, mrb_ary_entry(z, i), &real, &imag) || real < 0.0 || !b.real_base) {
+      mrb_complex c = cmath_log_batch_apply(&b, cmath_build_complex(real, imag));
+      CMATH_STAT(log, complex);
+      mrb_ary_push(mrb, result, mrb_complex_new(mrb, cmath_creal(c), cmath_cimag(c)));
+    } else {
+      CMATH_STAT(log, real);
+      mrb_ary_push(mrb, result, mrb_float_value(mrb, F(log)(real)/b.lr));
+    }
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  return result;
+}
+
+static const struct {
+  const char *name;
+  const struct cmath_func *f;
+} cmath_funcs[] = {
+  { "exp", &cmath_func_exp },
+  { "log", &cmath_func_log },
+  { "log10", &cmath_func_log10 },
+  { "log2", &cmath_func_log2 },
+  { "sqrt", &cmath_func_sqrt },
+  { "cis", &cmath_func_cis },
+  { "sin", &cmath_func_sin },
+  { "cos", &cmath_func_cos },
+  { "tan", &cmath_func_tan },
+  { "asin", &cmath_func_asin },
+  { "acos", &cmath_func_acos },
+  { "atan", &cmath_func_atan },
+  { "sinh", &cmath_func_sinh },
+  { "cosh", &cmath_func_cosh },
+  { "tanh", &cmath_func_tanh },
+  { "asinh", &cmath_func_asinh },
+  { "acosh", &cmath_func_acosh },
+  { "atanh", &cmath_func_atanh },
+};
+
+/* The element-wise function called name, or NULL */
+const struct cmath_func*
+cmath_func_find(mrb_state *mrb, mrb_sym name)
+{
+  const char *s = mrb_sym_name(mrb, name);
+  size_t i;
+
+  for (i = 0; i < sizeof(cmath_funcs)/sizeof(cmath_funcs[0]); i++) {
+    if (strcmp(s, cmath_funcs[i].name) == 0) {
+      return cmath_funcs[i].f;
+    }
+  }
+  return NULL;
+}
+
+/* ------------------------------------------------------------------------*/
+/* Paired functions: name(z) returns two results that share their work */
+
+typedef void cmath_rpairfunc(mrb_float, mrb_float*, mrb_float*);
+
+static void
+cmath_apply_pair(mrb_state *mrb, cmath_pairfunc *cfunc, cmath_rpairfunc *rfunc, int stat,
+                 mrb_value z, mrb_value *a, mrb_value *b)
+{
+  mrb_float real, imag;
+  if (cmath_get_complex(mrb, z, &real, &imag)) {
+    mrb_complex c = cmath_build_complex(real,imag);
+    mrb_complex ca, cb;
+    CMATH_STAT_ADD_ID(stat + 1, 1);
+    cfunc(c, &ca, &cb);
+    *a = mrb_complex_new(mrb, cmath_creal(ca), cmath_cimag(ca));
+    *b = mrb_complex_new(mrb, cmath_creal(cb), cmath_cimag(cb));
+  } else {
+    mrb_float ra, rb;
+    CMATH_STAT_ADD_ID(stat, 1);
+    rfunc(real, &ra, &rb);
+    *a = mrb_float_value(mrb, ra);
+    *b = mrb_float_value(mrb, rb);
+  }
+}
+
+struct cmath_pair_batch {
+  cmath_pairfunc *cfunc;
+  cmath_vpairfunc *vfunc;
+  mrb_complex *dsta, *dstb;
+  const mrb_complex *src;
+};
+
+static void
+cmath_pair_batch_run(void *arg, mrb_int begin, mrb_int end)
+{
+  const struct cmath_pair_batch *b = (const struct cmath_pair_batch*)arg;
+  mrb_int i;
+
+  if (b->vfunc) {
+    b->vfunc(b->dsta + begin, b->dstb + begin, b->src + begin, end - begin, b->cfunc);
+    return;
+  }
+  for (i = begin; i < end; i++) {
+    b->cfunc(b->src[i], &b->dsta[i], &b->dstb[i]);
+  }
+}
+
+static mrb_value
+cmath_map_pair(mrb_state *mrb, cmath_pairfunc *cfunc, cmath_rpairfunc *rfunc,
+               cmath_vpairfunc *vfunc, int stat, mrb_value z)
+{
+  mrb_value ra, rb;
+
+  if (cmath_buffer_p(mrb, z)) {
+    struct cmath_buffer *src = cmath_buffer_get(mrb, z);
+    struct cmath_buffer *dsta, *dstb;
+    struct cmath_pair_batch batch;
+
+    ra = cmath_buffer_new(mrb, src->len);
+    rb = cmath_buffer_new(mrb, src->len);
+    dsta = cmath_buffer_get(mrb, ra);
+    dstb = cmath_buffer_get(mrb, rb);
+    CMATH_STAT_ADD_ID(stat + 1, src->len);
+    batch.cfunc = cfunc;
+    batch.vfunc = vfunc;
+    batch.dsta = dsta->ptr;
+    batch.dstb = dstb->ptr;
+    batch.src = src->ptr;
+    cmath_parallel_for(src->len, cmath_pair_batch_run, &batch);
+  } else if (mrb_array_p(z)) {
+    int ai;
+    mrb_int i;
+
+    ra = mrb_ary_new_capa(mrb, RARRAY_LEN(z));
+    rb = mrb_ary_new_capa(mrb, RARRAY_LEN(z));
+    ai = mrb_gc_arena_save(mrb);
+    for (i = 0; i < RARRAY_LEN(z); i++) {
+      mrb_value a, b;
+      cmath_apply_pair(mrb, cfunc, rfunc, stat, mrb_ary_entry(z, i), &a, &b);
+      mrb_ary_push(mrb, ra, a);
+      mrb_ary_push(mrb, rb, b);
+      mrb_gc_arena_restore(mrb, ai);
+    }
+  } else {
+    mrb_raise(mrb, E_TYPE_ERROR, "Array or CMath::Buffer required");
+  }
+  return mrb_assoc_new(mrb, ra, rb);
+}
+
+#ifdef CMATH_VECTOR
+#define CMATH_VPAIRFUNC(name) cmath_v ## name
+#else
+#define CMATH_VPAIRFUNC(name) NULL
+#endif
+
+#define DEF_CMATH_PAIR(name) \
+static mrb_value \
+cmath_ ## name(mrb_state *mrb, mrb_value self)\
+{\
+  mrb_value a, b;\
+  cmath_apply_pair(mrb, cmath_c ## name, cmath_real_ ## name, CMATH_STAT_ ## name ## _real,\
+                   mrb_get_arg1(mrb), &a, &b);\
+  return mrb_assoc_new(mrb, a, b);\
+}\
+static mrb_value \
+cmath_ ## name ## _all(mrb_state *mrb, mrb_value self)\
+{\
+  return cmath_map_pair(mrb, cmath_c ## name, cmath_real_ ## name,\
+                        CMATH_VPAIRFUNC(name), CMATH_STAT_ ## name ## _real, mrb_get_arg1(mrb));\
+}
+
+/* sincos(z): [sin(z), cos(z)] */
+DEF_CMATH_PAIR(sincos)
+/* sinhcosh(z): [sinh(z), cosh(z)] */
+DEF_CMATH_PAIR(sinhcosh)
+
 /* ------------------------------------------------------------------------*/
 
 void
 mrb_mruby_cmath_alt_gem_init(mrb_state* mrb)
 {
-  struct RClass *cmath;
+  struct RClass *cmath, *buffer;
   cmath = mrb_define_module(mrb, "CMath");
 
   mrb_include_module(mrb, cmath, mrb_module_get(mrb, "Math"));
@@ -667,6 +1558,91 @@ mrb_mruby_cmath_alt_gem_init(mrb_state* mrb)
   mrb_define_module_function(mrb, cmath, "log2", cmath_log2, MRB_ARGS_REQ(1));
   mrb_define_module_function(mrb, cmath, "log10", cmath_log10, MRB_ARGS_REQ(1));
   mrb_define_module_function(mrb, cmath, "sqrt", cmath_sqrt, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "cis", cmath_cis, MRB_ARGS_REQ(1));
+
+  mrb_define_module_function(mrb, cmath, "sin_all", cmath_sin_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "cos_all", cmath_cos_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "tan_all", cmath_tan_all, MRB_ARGS_REQ(1));
+
+  mrb_define_module_function(mrb, cmath, "asin_all", cmath_asin_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "acos_all", cmath_acos_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "atan_all", cmath_atan_all, MRB_ARGS_REQ(1));
+
+  mrb_define_module_function(mrb, cmath, "sinh_all", cmath_sinh_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "cosh_all", cmath_cosh_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "tanh_all", cmath_tanh_all, MRB_ARGS_REQ(1));
+
+  mrb_define_module_function(mrb, cmath, "asinh_all", cmath_asinh_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "acosh_all", cmath_acosh_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "atanh_all", cmath_atanh_all, MRB_ARGS_REQ(1));
+
+  mrb_define_module_function(mrb, cmath, "exp_all", cmath_exp_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "log_all", cmath_log_base_all, MRB_ARGS_ARG(1,1));
+  mrb_define_module_function(mrb, cmath, "log2_all", cmath_log2_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "log10_all", cmath_log10_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "sqrt_all", cmath_sqrt_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "cis_all", cmath_cis_all, MRB_ARGS_REQ(1));
+
+  mrb_define_module_function(mrb, cmath, "sincos", cmath_sincos, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "sinhcosh", cmath_sinhcosh, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "sincos_all", cmath_sincos_all, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, cmath, "sinhcosh_all", cmath_sinhcosh_all, MRB_ARGS_REQ(1));
+
+  mrb_define_module_function(mrb, cmath, "sin_into", cmath_sin_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "cos_into", cmath_cos_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "tan_into", cmath_tan_into, MRB_ARGS_REQ(3));
+
+  mrb_define_module_function(mrb, cmath, "asin_into", cmath_asin_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "acos_into", cmath_acos_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "atan_into", cmath_atan_into, MRB_ARGS_REQ(3));
+
+  mrb_define_module_function(mrb, cmath, "sinh_into", cmath_sinh_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "cosh_into", cmath_cosh_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "tanh_into", cmath_tanh_into, MRB_ARGS_REQ(3));
+
+  mrb_define_module_function(mrb, cmath, "asinh_into", cmath_asinh_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "acosh_into", cmath_acosh_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "atanh_into", cmath_atanh_into, MRB_ARGS_REQ(3));
+
+  mrb_define_module_function(mrb, cmath, "exp_into", cmath_exp_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "log_into", cmath_log_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "log2_into", cmath_log2_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "log10_into", cmath_log10_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "sqrt_into", cmath_sqrt_into, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, cmath, "cis_into", cmath_cis_into, MRB_ARGS_REQ(3));
+
+  cmath_buffer_init(mrb, cmath);
+  buffer = mrb_class_get_under(mrb, cmath, "Buffer");
+
+  mrb_define_method(mrb, buffer, "sin!", cmath_buffer_sin_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "cos!", cmath_buffer_cos_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "tan!", cmath_buffer_tan_bang, MRB_ARGS_NONE());
+
+  mrb_define_method(mrb, buffer, "asin!", cmath_buffer_asin_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "acos!", cmath_buffer_acos_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "atan!", cmath_buffer_atan_bang, MRB_ARGS_NONE());
+
+  mrb_define_method(mrb, buffer, "sinh!", cmath_buffer_sinh_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "cosh!", cmath_buffer_cosh_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "tanh!", cmath_buffer_tanh_bang, MRB_ARGS_NONE());
+
+  mrb_define_method(mrb, buffer, "asinh!", cmath_buffer_asinh_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "acosh!", cmath_buffer_acosh_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "atanh!", cmath_buffer_atanh_bang, MRB_ARGS_NONE());
+
+  mrb_define_method(mrb, buffer, "exp!", cmath_buffer_exp_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "log!", cmath_buffer_log_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "log2!", cmath_buffer_log2_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "log10!", cmath_buffer_log10_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "sqrt!", cmath_buffer_sqrt_bang, MRB_ARGS_NONE());
+  mrb_define_method(mrb, buffer, "cis!", cmath_buffer_cis_bang, MRB_ARGS_NONE());
+
+  cmath_stats_init(mrb, cmath);
+  cmath_pool_init(mrb, cmath);
+  cmath_job_init(mrb, cmath);
+  cmath_backend_init(mrb, cmath);
+  cmath_fft_init(mrb, cmath);
+  cmath_conv_init(mrb, cmath);
 }
 
 void
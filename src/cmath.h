@@ -0,0 +1,289 @@
+/*
+** cmath.h - internal definitions shared by the CMath sources
+**
+** See Copyright Notice in mruby.h
+*/
+
+#ifndef CMATH_H
+#define CMATH_H
+
+#include <math.h>
+#include <mruby.h>
+
+#ifdef MRB_NO_FLOAT
+# error CMath conflicts with 'MRB_NO_FLOAT' configuration
+#endif
+
+#ifdef MRB_USE_FLOAT32
+#define F(x) x##f
+#else
+#define F(x) x
+#endif
+
+#if defined(_WIN32) && !defined(__MINGW32__)
+
+#ifdef MRB_USE_FLOAT32
+typedef _Fcomplex mrb_complex;
+#else
+typedef _Dcomplex mrb_complex;
+#endif
+
+static inline mrb_complex
+CXDIVf(mrb_complex x, mrb_float y)
+{
+  return cmath_build_complex(cmath_creal(x)/y, cmath_cimag(x)/y);
+}
+
+static inline mrb_complex
+CXDIVc(mrb_complex a, mrb_complex b)
+{
+  mrb_float ratio, den;
+  mrb_float abr, abi, cr, ci;
+
+  if ((abr = cmath_creal(b)) < 0)
+    abr = - abr;
+  if ((abi = cmath_cimag(b)) < 0)
+    abi = - abi;
+  if (abr <= abi) {
+    ratio = cmath_creal(b) / cmath_cimag(b);
+    den = cmath_cimag(a) * (1 + ratio*ratio);
+    cr = (cmath_creal(a)*ratio + cmath_cimag(a)) / den;
+    ci = (cmath_cimag(a)*ratio - cmath_creal(a)) / den;
+  }
+  else {
+    ratio = cmath_cimag(b) / cmath_creal(b);
+    den = cmath_creal(a) * (1 + ratio*ratio);
+    cr = (cmath_creal(a) + cmath_cimag(a)*ratio) / den;
+    ci = (cmath_cimag(a) - cmath_creal(a)*ratio) / den;
+  }
+  return cmath_build_complex(cr, ci);
+}
+
+#else
+
+#if defined(__cplusplus) && (defined(__APPLE__) || (defined(__clang__) && (defined(__FreeBSD__) || defined(__OpenBSD__))))
+
+#ifdef MRB_USE_FLOAT32
+typedef std::complex<float> mrb_complex;
+#else
+typedef std::complex<double> mrb_complex;
+#endif  /* MRB_USE_FLOAT32 */
+
+
+#else  /* cpp */
+
+#ifdef MRB_USE_FLOAT32
+typedef float _Complex mrb_complex;
+#else
+typedef double _Complex mrb_complex;
+#endif  /*  MRB_USE_FLOAT32 */
+
+static inline mrb_complex
+cmath_build_complex(mrb_float x, mrb_float y)
+{
+#ifdef __GNUC__
+  return __builtin_complex(x, y);
+#else
+  union { mrb_float r[2]; mrb_complex c; } u;
+
+  u.r[0] = x;
+  u.r[1] = y;
+  return u.c;
+#endif
+}
+
+static inline mrb_float
+cmath_creal(mrb_complex c)
+{
+#ifdef __GNUC__
+  return __real__(c);
+#else
+  union { mrb_float r[2]; mrb_complex c; } u;
+
+  u.c = c;
+  return u.r[0];
+#endif
+}
+
+static inline mrb_float
+cmath_cimag(mrb_complex c)
+{
+#ifdef __GNUC__
+  return __imag__(c);
+#else
+  union { mrb_float r[2]; mrb_complex c; } u;
+
+  u.c = c;
+  return u.r[1];
+#endif
+}
+#endif
+
+#define CXDIVf(x,y) (x)/(y)
+#define CXDIVc(x,y) (x)/(y)
+
+#endif
+
+/* Constants in mrb_float precision */
+#ifdef MRB_USE_FLOAT32
+#define CMATH_FLOAT_C(x) x##F
+#else
+#define CMATH_FLOAT_C(x) x
+#endif
+#define CMATH_LN2  CMATH_FLOAT_C(0.69314718055994530942)
+#define CMATH_LN10 CMATH_FLOAT_C(2.30258509299404568402)
+#define CMATH_PI_2 CMATH_FLOAT_C(1.57079632679489661923)
+#define CMATH_E    CMATH_FLOAT_C(2.71828182845904523536)
+
+/* Per-thread storage, where there are threads to keep apart */
+#ifdef CMATH_USE_PTHREAD
+#define CMATH_THREAD_LOCAL __thread
+#else
+#define CMATH_THREAD_LOCAL
+#endif
+
+/* Vector kernels need GCC vector extensions and are written for doubles */
+#if defined(__GNUC__) && !defined(MRB_USE_FLOAT32)
+#define CMATH_VECTOR
+#endif
+
+mrb_value mrb_complex_new(mrb_state *mrb, mrb_float real, mrb_float imag);
+void mrb_complex_get(mrb_state *mrb, mrb_value cpx, mrb_float*, mrb_float*);
+
+mrb_bool cmath_get_complex(mrb_state *mrb, mrb_value c, mrb_float *r, mrb_float *i);
+
+typedef mrb_complex cmath_cfunc(mrb_complex);
+typedef mrb_float cmath_rfunc(mrb_float);
+/* Applies a kernel to n packed values; lanes it cannot handle go to fallback.
+   dst may be the same array as src. */
+typedef void cmath_vfunc(mrb_complex *dst, const mrb_complex *src, mrb_int n, cmath_cfunc *fallback);
+
+/* Kernels returning two results, such as sin and cos of the same value */
+typedef void cmath_pairfunc(mrb_complex, mrb_complex*, mrb_complex*);
+typedef void cmath_vpairfunc(mrb_complex *dsta, mrb_complex *dstb, const mrb_complex *src,
+                             mrb_int n, cmath_pairfunc *fallback);
+
+#ifdef CMATH_VECTOR
+#if defined(__x86_64__) || defined(__i386__)
+#define CMATH_X86
+#endif
+
+/* Entry points to the vector kernels of the backend in use */
+cmath_vfunc cmath_vexp, cmath_vsin, cmath_vcos, cmath_vsinh, cmath_vcosh, cmath_vcis;
+cmath_vpairfunc cmath_vsincos, cmath_vsinhcosh;
+
+/* A set of vector kernels built for one instruction set */
+struct cmath_backend {
+  const char *name;
+  cmath_vfunc *exp, *sin, *cos, *sinh, *cosh, *cis;
+  cmath_vpairfunc *sincos, *sinhcosh;
+};
+
+#ifdef CMATH_X86
+extern const struct cmath_backend cmath_backend_sse2, cmath_backend_avx2, cmath_backend_avx512;
+#else
+extern const struct cmath_backend cmath_backend_generic;
+#endif
+#endif
+
+void cmath_backend_init(mrb_state *mrb, struct RClass *cmath);
+
+/* sin(y) and cos(y) from one argument reduction (trig.c) */
+void cmath_trig_sincos(double y, double *s, double *c);
+
+/* CMath::Buffer: a fixed-length array of packed mrb_complex values */
+struct cmath_buffer {
+  mrb_int len;
+  mrb_complex *ptr;
+  int refs;             /* the Buffer object, plus each CMath::Job using it */
+};
+
+mrb_value cmath_buffer_new(mrb_state *mrb, mrb_int len);
+struct cmath_buffer *cmath_buffer_get(mrb_state *mrb, mrb_value obj);
+mrb_bool cmath_buffer_p(mrb_state *mrb, mrb_value obj);
+mrb_int cmath_buffer_index(struct cmath_buffer *buf, mrb_int i);
+void cmath_buffer_modify(mrb_state *mrb, struct cmath_buffer *buf);
+void cmath_buffer_release(mrb_state *mrb, struct cmath_buffer *buf);
+void cmath_buffer_init(mrb_state *mrb, struct RClass *cmath);
+
+/* Worker pool: runs fn(arg, begin, end) over chunks covering [0, n),
+   in parallel when n is large and CMath.threads > 1 */
+typedef void cmath_task(void *arg, mrb_int begin, mrb_int end);
+void cmath_parallel_for(mrb_int n, cmath_task *fn, void *arg);
+void cmath_pool_init(mrb_state *mrb, struct RClass *cmath);
+
+/* Element-wise functions that Buffers can be run through, by name */
+struct cmath_func;
+const struct cmath_func *cmath_func_find(mrb_state *mrb, mrb_sym name);
+void cmath_apply_buffer(const struct cmath_func *f, mrb_complex *dst, const mrb_complex *src, mrb_int n);
+void cmath_job_init(mrb_state *mrb, struct RClass *cmath);
+
+/* CMath::FFT (fft.c).  A plan from cmath_fft_plan_get holds a reference
+   until cmath_fft_release; cmath_fft_execute is the unscaled forward
+   transform in place, with cmath_fft_work_size(n) elements of scratch. */
+struct cmath_fft_plan;
+struct cmath_fft_plan *cmath_fft_plan_get(mrb_state *mrb, mrb_int n);
+void cmath_fft_release(struct cmath_fft_plan *plan);
+void cmath_fft_execute(const struct cmath_fft_plan *plan, mrb_complex *data, mrb_complex *work);
+mrb_int cmath_fft_good_size(mrb_int n);
+mrb_int cmath_fft_work_size(mrb_int n);
+void cmath_fft_init(mrb_state *mrb, struct RClass *cmath);
+
+/* CMath.convolve, CMath.correlate and the overlap filters (conv.c) */
+void cmath_conv_init(mrb_state *mrb, struct RClass *cmath);
+
+/*
+ * Optional instrumentation, compiled in with CMATH_ENABLE_STATS.
+ * X(function, counter): "real" and "complex" count calls dispatched to
+ * the real and the complex kernel; the others count kernel branches.
+ */
+#define CMATH_STATS_LIST(X) \
+  X(exp, real) X(exp, complex) X(exp, nan) X(exp, inf) \
+  X(cis, real) X(cis, complex) X(cis, real_angle) \
+  X(log, real) X(log, complex) \
+  X(log10, real) X(log10, complex) \
+  X(log2, real) X(log2, complex) \
+  X(sqrt, real) X(sqrt, complex) X(sqrt, real_axis) X(sqrt, special) \
+  X(sqrt, scale_large) X(sqrt, scale_tiny) \
+  X(sin, real) X(sin, complex) \
+  X(cos, real) X(cos, complex) \
+  X(tan, real) X(tan, complex) \
+  X(asin, real) X(asin, complex) \
+  X(acos, real) X(acos, complex) \
+  X(atan, real) X(atan, complex) \
+  X(sinh, real) X(sinh, complex) X(sinh, special) \
+  X(cosh, real) X(cosh, complex) X(cosh, special) \
+  X(tanh, real) X(tanh, complex) X(tanh, special) X(tanh, cutoff1) X(tanh, cutoff2) \
+  X(asinh, real) X(asinh, complex) X(asinh, special) X(asinh, large) \
+  X(acosh, real) X(acosh, complex) X(acosh, special) X(acosh, large) \
+  X(atanh, real) X(atanh, complex) X(atanh, special) X(atanh, real_axis) X(atanh, imag_axis) \
+  X(sincos, real) X(sincos, complex) \
+  X(sinhcosh, real) X(sinhcosh, complex) \
+  X(real_sinhcosh, expm1) X(real_sinhcosh, exp) X(real_sinhcosh, half_exp) \
+  X(real_sincos, cody_waite) X(real_sincos, payne_hanek) \
+  X(fft, plan_hit) X(fft, plan_miss) \
+  X(convolve, direct) X(convolve, fft)
+
+enum cmath_stat_id {
+#define CMATH_STAT_ENUM(f, c) CMATH_STAT_ ## f ## _ ## c,
+  CMATH_STATS_LIST(CMATH_STAT_ENUM)
+#undef CMATH_STAT_ENUM
+  CMATH_STAT_COUNT
+};
+
+#ifdef CMATH_ENABLE_STATS
+extern unsigned long cmath_stats[CMATH_STAT_COUNT];
+
+/* Relaxed atomics: counters must not race, but need no ordering */
+#define CMATH_STAT_ADD_ID(id, n) ((void)__atomic_fetch_add(&cmath_stats[id], (unsigned long)(n), __ATOMIC_RELAXED))
+#define CMATH_STAT_ADD(f, c, n) CMATH_STAT_ADD_ID(CMATH_STAT_ ## f ## _ ## c, n)
+#define CMATH_STAT(f, c) CMATH_STAT_ADD_ID(CMATH_STAT_ ## f ## _ ## c, 1)
+#else
+#define CMATH_STAT_ADD_ID(id, n) ((void)0)
+#define CMATH_STAT_ADD(f, c, n) ((void)0)
+#define CMATH_STAT(f, c) ((void)0)
+#endif
+
+void cmath_stats_init(mrb_state *mrb, struct RClass *cmath);
+
+#endif  /* CMATH_H */
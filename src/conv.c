@@ -0,0 +1,498 @@
+/*
+** conv.c - CMath.convolve, CMath.correlate and streaming FFT filters
+**
+** See Copyright Notice in mruby.h
+*/
+
+/*
+** Short inputs are convolved directly.  Longer ones are padded to a size
+** FFT transforms directly, transformed, multiplied and transformed back;
+** the zero padding keeps the circular convolution from wrapping.
+**
+** CMath::OverlapAdd and CMath::OverlapSave filter a stream block by block
+** with one fixed kernel, whose transform is computed once.  Overlap-add
+** transforms each block on its own and carries the tail of its output
+** into the next block; overlap-save transforms each block together with
+** the last taps - 1 samples before it and keeps only the outputs the
+** wraparound has not reached.  Both produce exactly the samples
+** CMath.convolve would for the whole stream, so far as it has been read.
+*/
+
+#include <string.h>
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include "cmath.h"
+
+/* Inputs with no more elements than this on one side are convolved directly */
+#ifndef CMATH_CONV_DIRECT_MAX
+#define CMATH_CONV_DIRECT_MAX 32
+#endif
+
+/* Block transform size of a filter made without a block size, at least */
+#define CMATH_FILTER_MIN_SIZE 64
+
+/* a*b, without the NaN recovery of the C99 complex multiply */
+static inline mrb_complex
+cmath_conv_mul(mrb_complex a, mrb_complex b)
+{
+  mrb_float ar = cmath_creal(a), ai = cmath_cimag(a);
+  mrb_float br = cmath_creal(b), bi = cmath_cimag(b);
+
+  return cmath_build_complex(ar*br - ai*bi, ar*bi + ai*br);
+}
+
+/*
+ * The elements of v, an Array of Numeric or a Buffer, and their number.
+ * An Array is copied into a new Buffer, which the arena keeps alive.
+ */
+static const mrb_complex*
+cmath_conv_values(mrb_state *mrb, mrb_value v, mrb_int *len)
+{
+  if (mrb_array_p(v)) {
+    mrb_complex *p;
+    mrb_float r, i;
+    mrb_int k;
+
+    *len = RARRAY_LEN(v);
+    p = cmath_buffer_get(mrb, cmath_buffer_new(mrb, *len))->ptr;
+    for (k = 0; k < *len; k++) {
+      cmath_get_complex(mrb, mrb_ary_entry(v, k), &r, &i);
+      p[k] = cmath_build_complex(r, i);
+    }
+    return p;
+  }
+  if (cmath_buffer_p(mrb, v)) {
+    struct cmath_buffer *buf = cmath_buffer_get(mrb, v);
+
+    *len = buf->len;
+    return buf->ptr;
+  }
+  mrb_raise(mrb, E_TYPE_ERROR, "Array or CMath::Buffer required");
+  return NULL;
+}
+
+/* Inverse of cmath_fft_execute in place, scaled by scale rather than 1/n */
+static void
+cmath_conv_inverse(const struct cmath_fft_plan *plan, mrb_complex *data, mrb_int n,
+                   mrb_complex *work, mrb_float scale)
+{
+  mrb_int i;
+
+  for (i = 0; i < n; i++) {
+    data[i] = cmath_build_complex(cmath_creal(data[i]), -cmath_cimag(data[i]));
+  }
+  cmath_fft_execute(plan, data, work);
+  for (i = 0; i < n; i++) {
+    data[i] = cmath_build_complex(cmath_creal(data[i])*scale, -cmath_cimag(data[i])*scale);
+  }
+}
+
+/* out[0, na+nb-1) = a * b, term by term */
+static void
+cmath_conv_direct(mrb_complex *out, const mrb_complex *a, mrb_int na,
+                  const mrb_complex *b, mrb_int nb)
+{
+  mrb_int i, j;
+
+  for (i = 0; i < na + nb - 1; i++) {
+    out[i] = cmath_build_complex(0.0F, 0.0F);
+  }
+  for (i = 0; i < na; i++) {
+    mrb_complex *o = out + i;
+
+    for (j = 0; j < nb; j++) {
+      o[j] += cmath_conv_mul(a[i], b[j]);
+    }
+  }
+}
+
+/* out[0, na+nb-1) = a * b, through transforms of the next good size */
+static void
+cmath_conv_fft(mrb_state *mrb, mrb_complex *out, const mrb_complex *a, mrb_int na,
+               const mrb_complex *b, mrb_int nb)
+{
+  mrb_int n = na + nb - 1;
+  mrb_int l = cmath_fft_good_size(n);
+  mrb_complex *x, *y, *work;
+  struct cmath_fft_plan *plan;
+  mrb_int i;
+
+  /* Scratch space in a Buffer, so that the collector reclaims it */
+  x = cmath_buffer_get(mrb, cmath_buffer_new(mrb, 2*l + cmath_fft_work_size(l)))->ptr;
+  y = x + l;
+  work = y + l;
+  memcpy(x, a, na * sizeof(mrb_complex));
+  memcpy(y, b, nb * sizeof(mrb_complex));
+  /* Buffers start out zeroed, so the padding is already there */
+
+  plan = cmath_fft_plan_get(mrb, l);
+  cmath_fft_execute(plan, x, work);
+  cmath_fft_execute(plan, y, work);
+  for (i = 0; i < l; i++) {
+    x[i] = cmath_conv_mul(x[i], y[i]);
+  }
+  cmath_conv_inverse(plan, x, l, work, 1.0F / (mrb_float)l);
+  cmath_fft_release(plan);
+  memcpy(out, x, n * sizeof(mrb_complex));
+}
+
+/* convolve and correlate, once b is in the order it is to be applied */
+static mrb_value
+cmath_conv_run(mrb_state *mrb, const mrb_complex *a, mrb_int na,
+               const mrb_complex *b, mrb_int nb, mrb_sym method)
+{
+  mrb_value result;
+  mrb_complex *out;
+  mrb_bool fft;
+
+  if (method == mrb_intern_lit(mrb, "auto")) {
+    fft = na > CMATH_CONV_DIRECT_MAX && nb > CMATH_CONV_DIRECT_MAX;
+  }
+  else if (method == mrb_intern_lit(mrb, "direct")) {
+    fft = FALSE;
+  }
+  else if (method == mrb_intern_lit(mrb, "fft")) {
+    fft = TRUE;
+  }
+  else {
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown convolution method: %n", method);
+    return mrb_nil_value();
+  }
+  if (na < 1 || nb < 1) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "cannot convolve an empty sequence");
+  }
+
+  result = cmath_buffer_new(mrb, na + nb - 1);
+  out = cmath_buffer_get(mrb, result)->ptr;
+  if (fft) {
+    CMATH_STAT(convolve, fft);
+    cmath_conv_fft(mrb, out, a, na, b, nb);
+  }
+  else {
+    CMATH_STAT(convolve, direct);
+    cmath_conv_direct(out, a, na, b, nb);
+  }
+  return result;
+}
+
+/*
+ * convolve(a, b, method = :auto) -> CMath::Buffer
+ *
+ * The full linear convolution of a and b, each an Array of Numeric or a
+ * Buffer: na + nb - 1 elements,
+ *   c[k] = sum of a[j]*b[k-j] over the j where both are defined.
+ * method is :direct, :fft, or :auto to use FFTs when both inputs are
+ * longer than 32 elements.
+ */
+static mrb_value
+cmath_convolve(mrb_state *mrb, mrb_value self)
+{
+  mrb_value va, vb;
+  mrb_sym method = mrb_intern_lit(mrb, "auto");
+  const mrb_complex *a, *b;
+  mrb_int na, nb;
+
+  mrb_get_args(mrb, "oo|n", &va, &vb, &method);
+  a = cmath_conv_values(mrb, va, &na);
+  b = cmath_conv_values(mrb, vb, &nb);
+  return cmath_conv_run(mrb, a, na, b, nb, method);
+}
+
+/*
+ * correlate(a, b, method = :auto) -> CMath::Buffer
+ *
+ * The full cross-correlation of a and b, at lags -(nb-1) to na-1 in
+ * that order:
+ *   c[k + nb - 1] = sum of a[j+k]*conj(b[j]) over the j where both are
+ * defined.  Arguments are as for convolve.
+ */
+static mrb_value
+cmath_correlate(mrb_state *mrb, mrb_value self)
+{
+  mrb_value va, vb;
+  mrb_sym method = mrb_intern_lit(mrb, "auto");
+  const mrb_complex *a, *b;
+  mrb_complex *rb;
+  mrb_int na, nb, i;
+
+  mrb_get_args(mrb, "oo|n", &va, &vb, &method);
+  a = cmath_conv_values(mrb, va, &na);
+  b = cmath_conv_values(mrb, vb, &nb);
+  rb = cmath_buffer_get(mrb, cmath_buffer_new(mrb, nb))->ptr;
+  for (i = 0; i < nb; i++) {
+    rb[i] = cmath_build_complex(cmath_creal(b[nb - 1 - i]), -cmath_cimag(b[nb - 1 - i]));
+  }
+  return cmath_conv_run(mrb, a, na, rb, nb, method);
+}
+
+/*
+ * A streaming filter.  Blocks of up to `block` input samples are
+ * transformed at `size` = block + taps - 1, a size FFT does directly.
+ */
+struct cmath_filter {
+  mrb_int taps;         /* kernel length */
+  mrb_int size;         /* transform size */
+  mrb_int block;        /* input samples per transform */
+  mrb_bool save;        /* overlap-save rather than overlap-add */
+  struct cmath_fft_plan *plan;
+  mrb_complex *kernel;  /* transform of the kernel, scaled by 1/size */
+  mrb_complex *state;   /* taps - 1: pending output tail, or past input */
+  mrb_complex *frame;   /* size, then size more of scratch */
+};
+
+static void
+cmath_filter_free(mrb_state *mrb, void *p)
+{
+  struct cmath_filter *f = (struct cmath_filter*)p;
+
+  if (f) {
+    if (f->plan) cmath_fft_release(f->plan);
+    mrb_free(mrb, f->kernel);
+    mrb_free(mrb, f->state);
+    mrb_free(mrb, f->frame);
+    mrb_free(mrb, f);
+  }
+}
+
+static const struct mrb_data_type cmath_filter_type = {
+  "CMath::Filter", cmath_filter_free,
+};
+
+static struct cmath_filter*
+cmath_filter_get(mrb_state *mrb, mrb_value self)
+{
+  struct cmath_filter *f = DATA_GET_PTR(mrb, self, &cmath_filter_type, struct cmath_filter);
+
+  if (f == NULL) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "uninitialized filter");
+  }
+  return f;
+}
+
+static mrb_value
+cmath_filter_setup(mrb_state *mrb, mrb_value self, mrb_bool save)
+{
+  mrb_value vk, vblock = mrb_nil_value();
+  struct cmath_filter *f = (struct cmath_filter*)DATA_PTR(self);
+  const mrb_complex *k;
+  mrb_complex *work;
+  mrb_int taps, size, i;
+  mrb_float scale;
+
+  mrb_get_args(mrb, "o|o", &vk, &vblock);
+  if (f) cmath_filter_free(mrb, f);
+  mrb_data_init(self, NULL, &cmath_filter_type);
+
+  k = cmath_conv_values(mrb, vk, &taps);
+  if (taps < 1) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "filter kernel is empty");
+  }
+  if (mrb_nil_p(vblock)) {
+    size = taps < CMATH_FILTER_MIN_SIZE / 4 ? CMATH_FILTER_MIN_SIZE : 4*taps;
+  }
+  else if (!mrb_integer_p(vblock)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "block size must be an Integer");
+  }
+  else if (mrb_integer(vblock) < 1) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "block size must be positive");
+  }
+  else {
+    size = mrb_integer(vblock);
+  }
+  if (size > (mrb_int)(MRB_INT_MAX / 4 / sizeof(mrb_complex)) - taps) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "block size too big");
+  }
+  if (!mrb_nil_p(vblock)) size += taps - 1;
+  size = cmath_fft_good_size(size);
+
+  f = (struct cmath_filter*)mrb_malloc(mrb, sizeof(struct cmath_filter));
+  f->taps = taps;
+  f->size = size;
+  f->block = size - taps + 1;
+  f->save = save;
+  f->plan = NULL;
+  f->kernel = f->state = f->frame = NULL;
+  mrb_data_init(self, f, &cmath_filter_type);
+  f->plan = cmath_fft_plan_get(mrb, size);
+
+  /* taps, not taps - 1, so that nothing is a zero-size allocation */
+  f->state = (mrb_complex*)mrb_malloc(mrb, taps * sizeof(mrb_complex));
+  f->frame = (mrb_complex*)mrb_malloc(mrb, 2 * size * sizeof(mrb_complex));
+  f->kernel = (mrb_complex*)mrb_malloc(mrb, size * sizeof(mrb_complex));
+  for (i = 0; i < taps; i++) {
+    f->state[i] = cmath_build_complex(0.0F, 0.0F);
+  }
+  memcpy(f->kernel, k, taps * sizeof(mrb_complex));
+  for (i = taps; i < size; i++) {
+    f->kernel[i] = cmath_build_complex(0.0F, 0.0F);
+  }
+
+  work = f->frame + size;
+  cmath_fft_execute(f->plan, f->kernel, work);
+  scale = 1.0F / (mrb_float)size;
+  for (i = 0; i < size; i++) {
+    f->kernel[i] = cmath_build_complex(cmath_creal(f->kernel[i])*scale, cmath_cimag(f->kernel[i])*scale);
+  }
+  return self;
+}
+
+/*
+ * OverlapAdd.new(kernel, block = nil)  -> filter
+ * OverlapSave.new(kernel, block = nil) -> filter
+ *
+ * A filter that convolves a stream with kernel, an Array of Numeric or a
+ * Buffer.  Each transform takes up to block input samples, or more if a
+ * faster transform size allows; by default, the transform size is about
+ * four times the kernel length.
+ */
+static mrb_value
+cmath_overlap_add_initialize(mrb_state *mrb, mrb_value self)
+{
+  return cmath_filter_setup(mrb, self, FALSE);
+}
+
+static mrb_value
+cmath_overlap_save_initialize(mrb_state *mrb, mrb_value self)
+{
+  return cmath_filter_setup(mrb, self, TRUE);
+}
+
+/* Filters n samples of in, or n zeros if in is NULL, into out */
+static void
+cmath_filter_run(struct cmath_filter *f, mrb_complex *out, const mrb_complex *in, mrb_int n)
+{
+  mrb_int hist = f->taps - 1;
+  mrb_complex *frame = f->frame;
+  mrb_complex *work = f->frame + f->size;
+  mrb_int pos, c, i;
+
+  for (pos = 0; pos < n; pos += c) {
+    mrb_int start = f->save ? hist : 0;
+
+    c = n - pos < f->block ? n - pos : f->block;
+    if (f->save) {
+      memcpy(frame, f->state, hist * sizeof(mrb_complex));
+    }
+    if (in) {
+      memcpy(frame + start, in + pos, c * sizeof(mrb_complex));
+    }
+    else {
+      for (i = 0; i < c; i++) frame[start + i] = cmath_build_complex(0.0F, 0.0F);
+    }
+    for (i = start + c; i < f->size; i++) {
+      frame[i] = cmath_build_complex(0.0F, 0.0F);
+    }
+    if (f->save) {
+      /* The last taps - 1 samples read so far */
+      memmove(f->state, frame + c, hist * sizeof(mrb_complex));
+    }
+
+    cmath_fft_execute(f->plan, frame, work);
+    for (i = 0; i < f->size; i++) {
+      frame[i] = cmath_conv_mul(frame[i], f->kernel[i]);
+    }
+    cmath_conv_inverse(f->plan, frame, f->size, work, 1.0F);
+
+    if (f->save) {
+      /* The first taps - 1 outputs have wrapped around */
+      memcpy(out + pos, frame + hist, c * sizeof(mrb_complex));
+    }
+    else {
+      for (i = 0; i < c; i++) {
+        out[pos + i] = i < hist ? frame[i] + f->state[i] : frame[i];
+      }
+      /* The tail carries over, with whatever of the old one is not yet out */
+      for (i = 0; i < hist; i++) {
+        f->state[i] = c + i < hist ? frame[c + i] + f->state[c + i] : frame[c + i];
+      }
+    }
+  }
+}
+
+/*
+ * process(input) -> CMath::Buffer
+ *
+ * Feeds input, an Array of Numeric or a Buffer, through the filter, and
+ * returns as many output samples.  Every call continues where the last
+ * one left off.
+ */
+static mrb_value
+cmath_filter_process(mrb_state *mrb, mrb_value self)
+{
+  struct cmath_filter *f = cmath_filter_get(mrb, self);
+  const mrb_complex *in;
+  mrb_value result;
+  mrb_int n;
+
+  in = cmath_conv_values(mrb, mrb_get_arg1(mrb), &n);
+  result = cmath_buffer_new(mrb, n);
+  cmath_filter_run(f, cmath_buffer_get(mrb, result)->ptr, in, n);
+  return result;
+}
+
+/*
+ * flush -> CMath::Buffer
+ *
+ * The last kernel_size - 1 output samples, as if the input were followed
+ * by zeros; the filter is then as newly made.
+ */
+static mrb_value
+cmath_filter_flush(mrb_state *mrb, mrb_value self)
+{
+  struct cmath_filter *f = cmath_filter_get(mrb, self);
+  mrb_value result = cmath_buffer_new(mrb, f->taps - 1);
+
+  cmath_filter_run(f, cmath_buffer_get(mrb, result)->ptr, NULL, f->taps - 1);
+  return result;
+}
+
+/* reset: forget the input so far; returns self */
+static mrb_value
+cmath_filter_reset(mrb_state *mrb, mrb_value self)
+{
+  struct cmath_filter *f = cmath_filter_get(mrb, self);
+  mrb_int i;
+
+  for (i = 0; i < f->taps; i++) {
+    f->state[i] = cmath_build_complex(0.0F, 0.0F);
+  }
+  return self;
+}
+
+/* block_size: input samples transformed at a time */
+static mrb_value
+cmath_filter_block_size(mrb_state *mrb, mrb_value self)
+{
+  return mrb_int_value(mrb, cmath_filter_get(mrb, self)->block);
+}
+
+/* kernel_size: the number of taps */
+static mrb_value
+cmath_filter_kernel_size(mrb_state *mrb, mrb_value self)
+{
+  return mrb_int_value(mrb, cmath_filter_get(mrb, self)->taps);
+}
+
+void
+cmath_conv_init(mrb_state *mrb, struct RClass *cmath)
+{
+  struct RClass *filter, *ola, *ols;
+
+  mrb_define_module_function(mrb, cmath, "convolve", cmath_convolve, MRB_ARGS_ARG(2, 1));
+  mrb_define_module_function(mrb, cmath, "correlate", cmath_correlate, MRB_ARGS_ARG(2, 1));
+
+  filter = mrb_define_class_under(mrb, cmath, "Filter", mrb->object_class);
+  MRB_SET_INSTANCE_TT(filter, MRB_TT_CDATA);
+  mrb_define_method(mrb, filter, "process", cmath_filter_process, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, filter, "flush", cmath_filter_flush, MRB_ARGS_NONE());
+  mrb_define_method(mrb, filter, "reset", cmath_filter_reset, MRB_ARGS_NONE());
+  mrb_define_method(mrb, filter, "block_size", cmath_filter_block_size, MRB_ARGS_NONE());
+  mrb_define_method(mrb, filter, "kernel_size", cmath_filter_kernel_size, MRB_ARGS_NONE());
+
+  ola = mrb_define_class_under(mrb, cmath, "OverlapAdd", filter);
+  mrb_define_method(mrb, ola, "initialize", cmath_overlap_add_initialize, MRB_ARGS_ARG(1, 1));
+  ols = mrb_define_class_under(mrb, cmath, "OverlapSave", filter);
+  mrb_define_method(mrb, ols, "initialize", cmath_overlap_save_initialize, MRB_ARGS_ARG(1, 1));
+}
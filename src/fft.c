@@ -0,0 +1,1585 @@
+/*
+** fft.c - CMath::FFT, fast Fourier transforms of CMath::Buffer
+**
+** See Copyright Notice in mruby.h
+*/
+
+/*
+** The transforms are Stockham autosort FFTs: each pass reads one array
+** and writes the other, both in natural order, so there is no bit
+** reversal.  Sizes that are products of 2, 3, 5 and 7 are transformed
+** directly, with radix-4 passes while two factors of 2 remain; any other
+** size goes through Bluestein's algorithm, as a convolution with a chirp
+** done by transforms of such a size.  Every twiddle factor is an entry
+** of the table W[j] = exp(-2*pi*i*j/n), built from the same sin and cos
+** as cmath_cexp.  The inverse conjugates, transforms, conjugates back and
+** scales by 1/n.
+**
+** A plan holds the factorization and the twiddle table for one size.
+** Plans are shared by every mrb_state in the process: the most recently
+** used ones are kept in a small LRU cache, and FFT.export_wisdom and
+** FFT.import_wisdom (or save_wisdom and load_wisdom, with a file) write
+** the cached tables out and read them back, checked against this build.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mruby.h>
+#include <mruby/array.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include <mruby/string.h>
+#include "cmath.h"
+
+#ifdef CMATH_USE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifndef MRB_NO_STDIO
+#include <stdio.h>
+#endif
+
+/* Enough for any mrb_int size */
+#define CMATH_FFT_MAX_FACTORS 64
+
+/* Largest size whose twiddle table can be allocated */
+#define CMATH_FFT_SIZE_MAX (SIZE_MAX / sizeof(mrb_complex))
+
+/* Plans kept in the cache */
+#ifndef CMATH_FFT_CACHE_SIZE
+#define CMATH_FFT_CACHE_SIZE 16
+#endif
+
+struct cmath_fft_plan {
+  mrb_int n;
+  int nfactors;
+  int factors[CMATH_FFT_MAX_FACTORS];   /* radix of each pass, in order */
+  mrb_complex *twiddle;                 /* W[j] for j < n */
+  mrb_int tstride;      /* W[j] is twiddle[j*tstride] */
+  /* Bluestein plans, for sizes with other prime factors */
+  struct cmath_fft_plan *sub;           /* the plan the convolution runs on */
+  mrb_complex *chirp;                   /* exp(-pi*i*k^2/n) for k < n */
+  mrb_complex *filter;                  /* transform of conj(chirp), scaled by 1/sub->n */
+  int refs;             /* the cache, each Plan object and each transform running */
+  struct cmath_fft_plan *prev, *next;   /* LRU order, while cached */
+};
+
+static inline mrb_complex
+cmath_fft_mul(mrb_complex a, mrb_complex b)
+{
+  mrb_float ar = cmath_creal(a), ai = cmath_cimag(a);
+  mrb_float br = cmath_creal(b), bi = cmath_cimag(b);
+
+  return cmath_build_complex(ar*br - ai*bi, ar*bi + ai*br);
+}
+
+/* -i*a */
+static inline mrb_complex
+cmath_fft_mul_mi(mrb_complex a)
+{
+  return cmath_build_complex(cmath_cimag(a), -cmath_creal(a));
+}
+
+/* Split n into passes; false if n has a prime factor over 7 */
+static mrb_bool
+cmath_fft_factor(struct cmath_fft_plan *p, mrb_int n)
+{
+  static const int radices[] = { 2, 3, 5, 7 };
+  int i;
+
+  p->n = n;
+  p->tstride = 1;
+  p->nfactors = 0;
+  while (n % 4 == 0) {
+    p->factors[p->nfactors++] = 4;
+    n /= 4;
+  }
+  for (i = 0; i < 4; i++) {
+    while (n % radices[i] == 0) {
+      p->factors[p->nfactors++] = radices[i];
+      n /= radices[i];
+    }
+  }
+  return n == 1;
+}
+
+/* True if n has no prime factor over 7 */
+static mrb_bool
+cmath_fft_smooth(mrb_int n)
+{
+  static const int radices[] = { 2, 3, 5, 7 };
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    while (n % radices[i] == 0) n /= radices[i];
+  }
+  return n == 1;
+}
+
+/*
+ * The smallest size >= n that is transformed directly, from the products
+ * 2^a*3^b*5^c*7^d below the next power of 2; n itself if n is over
+ * MRB_INT_MAX/4, where no plan could be allocated anyway.
+ */
+mrb_int
+cmath_fft_good_size(mrb_int n)
+{
+  uint64_t best, p7, p5, p3, p;
+
+  if (n <= 1) return 1;
+  if (n > MRB_INT_MAX / 4) return n;
+  for (best = 1; best < (uint64_t)n; best *= 2)
+    ;
+  for (p7 = 1; p7 < best; p7 *= 7) {
+    for (p5 = p7; p5 < best; p5 *= 5) {
+      for (p3 = p5; p3 < best; p3 *= 3) {
+        for (p = p3; p < (uint64_t)n; p *= 2)
+          ;
+        if (p < best) best = p;
+      }
+    }
+  }
+  return (mrb_int)best;
+}
+
+/* Largest Bluestein size: the convolution size, under 4n, has to fit in
+   mrb_int and its tables in memory */
+#define CMATH_FFT_CHIRP_MAX \
+  ((uint64_t)(MRB_INT_MAX / 8) < SIZE_MAX / (4*sizeof(mrb_complex)) ? \
+   MRB_INT_MAX / 8 : (mrb_int)(SIZE_MAX / (4*sizeof(mrb_complex))))
+
+/* Elements of scratch space a transform of size n needs */
+mrb_int
+cmath_fft_work_size(mrb_int n)
+{
+  /* Sizes over the limit get no plan */
+  if (cmath_fft_smooth(n) || n > CMATH_FFT_CHIRP_MAX) return n;
+  return 2*cmath_fft_good_size(2*n - 1);
+}
+
+/* W[j] = exp(-2*pi*i*j/n) */
+static mrb_complex
+cmath_fft_twiddle(mrb_int n, mrb_int j)
+{
+  static const double two_pi = 6.28318530717958647693;
+  /* Keep the angle within [-pi, pi] */
+  mrb_int k = j <= n/2 ? j : j - n;
+  double s, c;
+
+  cmath_trig_sincos(-two_pi*(double)k/(double)n, &s, &c);
+  return cmath_build_complex((mrb_float)c, (mrb_float)s);
+}
+
+static void
+cmath_fft_twiddles(mrb_complex *w, mrb_int n)
+{
+  mrb_int j;
+
+  for (j = 0; j < n; j++) {
+    w[j] = cmath_fft_twiddle(n, j);
+  }
+}
+
+/*
+ * One decimation-in-frequency pass of radix r over sequences of length
+ * r*m interleaved with stride s (n = r*m*s):
+ *   y[q + s*(r*p + k)] = W^(p*k*s) * sum_j x[q + s*(p + j*m)] * W^(j*k*n/r)
+ */
+static void
+cmath_fft_pass(const struct cmath_fft_plan *plan, int r, mrb_int m, mrb_int s,
+               const mrb_complex *x, mrb_complex *y)
+{
+  const mrb_complex *w = plan->twiddle;
+  mrb_int p, q;
+
+  for (p = 0; p < m; p++) {
+    const mrb_complex *xp = x + s*p;
+    mrb_complex *yp = y + s*r*p;
+    mrb_int ps = p*s*plan->tstride;
+
+    switch (r) {
+    case 2: {
+      mrb_complex w1 = w[ps];
+
+      for (q = 0; q < s; q++) {
+        mrb_complex a0 = xp[q], a1 = xp[q + s*m];
+
+        yp[q] = a0 + a1;
+        yp[q + s] = cmath_fft_mul(a0 - a1, w1);
+      }
+      break;
+    }
+    case 3: {
+      static const mrb_float sin60 = CMATH_FLOAT_C(0.86602540378443864676);
+      mrb_complex w1 = w[ps], w2 = w[2*ps];
+
+      for (q = 0; q < s; q++) {
+        mrb_complex a0 = xp[q], a1 = xp[q + s*m], a2 = xp[q + 2*s*m];
+        mrb_complex t = a1 + a2;
+        mrb_complex u = a0 - 0.5F*t;
+        mrb_complex v = cmath_fft_mul_mi(sin60*(a1 - a2));
+
+        yp[q] = a0 + t;
+        yp[q + s] = cmath_fft_mul(u + v, w1);
+        yp[q + 2*s] = cmath_fft_mul(u - v, w2);
+      }
+      break;
+    }
+    case 4: {
+      mrb_complex w1 = w[ps], w2 = w[2*ps], w3 = w[3*ps];
+
+      for (q = 0; q < s; q++) {
+        mrb_complex a0 = xp[q], a1 = xp[q + s*m], a2 = xp[q + 2*s*m], a3 = xp[q + 3*s*m];
+        mrb_complex t0 = a0 + a2, t1 = a0 - a2;
+        mrb_complex t2 = a1 + a3, t3 = cmath_fft_mul_mi(a1 - a3);
+
+        yp[q] = t0 + t2;
+        yp[q + s] = cmath_fft_mul(t1 + t3, w1);
+        yp[q + 2*s] = cmath_fft_mul(t0 - t2, w2);
+        yp[q + 3*s] = cmath_fft_mul(t1 - t3, w3);
+      }
+      break;
+    }
+    default: {
+      /* 5 and 7: a direct DFT, with roots of unity from the table */
+      mrb_int root = plan->n / r * plan->tstride;
+      int j, k;
+
+      for (q = 0; q < s; q++) {
+        for (k = 0; k < r; k++) {
+          mrb_complex b = xp[q];
+
+          for (j = 1; j < r; j++) {
+            b += cmath_fft_mul(xp[q + j*s*m], w[(j*k % r)*root]);
+          }
+          yp[q + k*s] = k == 0 ? b : cmath_fft_mul(b, w[k*ps]);
+        }
+      }
+      break;
+    }
+    }
+  }
+}
+
+/* Forward transform of data in place, for sizes that factor; work holds n elements */
+static void
+cmath_fft_stockham(const struct cmath_fft_plan *plan, mrb_complex *data, mrb_complex *work)
+{
+  mrb_complex *x = data, *y = work, *t;
+  mrb_int m = plan->n, s = 1;
+  int i;
+
+  for (i = 0; i < plan->nfactors; i++) {
+    int r = plan->factors[i];
+
+    m /= r;
+    cmath_fft_pass(plan, r, m, s, x, y);
+    s *= r;
+    t = x;
+    x = y;
+    y = t;
+  }
+  if (x != data) {
+    memcpy(data, x, plan->n * sizeof(mrb_complex));
+  }
+}
+
+static void
+cmath_fft_conj(mrb_complex *data, mrb_int n, mrb_float scale)
+{
+  mrb_int i;
+
+  for (i = 0; i < n; i++) {
+    data[i] = cmath_build_complex(cmath_creal(data[i])*scale, -cmath_cimag(data[i])*scale);
+  }
+}
+
+static inline mrb_complex
+cmath_fft_conj1(mrb_complex c)
+{
+  return cmath_build_complex(cmath_creal(c), -cmath_cimag(c));
+}
+
+/* exp(re + i*im), with the sin and cos of cmath_cexp */
+static mrb_complex
+cmath_fft_cexp(double re, double im)
+{
+  double s, c, e = exp(re);
+
+  cmath_trig_sincos(im, &s, &c);
+  return cmath_build_complex((mrb_float)(e*c), (mrb_float)(e*s));
+}
+
+/*
+ * The convolution at the heart of Bluestein's algorithm and the chirp
+ * z-transform, over l = sub->n >= n + m - 1 points:
+ *   out[k] = post[k] * sum_j x[j]*pre[j]*h[k-j],  k < m,
+ * where filter is the transform of h, scaled by 1/l, and h[-t] is at l-t.
+ * x and out may be the same array; work holds 2*l elements.
+ */
+static void
+cmath_fft_chirp(const struct cmath_fft_plan *sub, const mrb_complex *filter,
+                const mrb_complex *x, const mrb_complex *pre, mrb_int n,
+                mrb_complex *out, const mrb_complex *post, mrb_int m, mrb_complex *work)
+{
+  mrb_int l = sub->n, k;
+  mrb_complex *a = work;
+
+  for (k = 0; k < n; k++) {
+    a[k] = cmath_fft_mul(x[k], pre[k]);
+  }
+  for (; k < l; k++) {
+    a[k] = 0;
+  }
+  cmath_fft_stockham(sub, a, work + l);
+  /* Multiply, and transform back by conjugating around the forward transform */
+  for (k = 0; k < l; k++) {
+    a[k] = cmath_fft_conj1(cmath_fft_mul(a[k], filter[k]));
+  }
+  cmath_fft_stockham(sub, a, work + l);
+  for (k = 0; k < m; k++) {
+    out[k] = cmath_fft_mul(cmath_fft_conj1(a[k]), post[k]);
+  }
+}
+
+/*
+ * Forward transform of data in place; work holds cmath_fft_work_size(n)
+ * elements.  Bluestein: with c[k] = exp(-pi*i*k^2/n), jk = (j^2 + k^2 -
+ * (k-j)^2)/2 makes X[k] = c[k] * sum_j x[j]*c[j]*conj(c[k-j]).
+ */
+void
+cmath_fft_execute(const struct cmath_fft_plan *plan, mrb_complex *data, mrb_complex *work)
+{
+  if (plan->sub) {
+    cmath_fft_chirp(plan->sub, plan->filter, data, plan->chirp, plan->n,
+                    data, plan->chirp, plan->n, work);
+  }
+  else {
+    cmath_fft_stockham(plan, data, work);
+  }
+}
+
+/* The plan cache, most recently used first */
+static struct cmath_fft_plan *fft_cache_head, *fft_cache_tail;
+static int fft_cache_count;
+
+#ifdef CMATH_USE_PTHREAD
+static pthread_mutex_t fft_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define FFT_LOCK() pthread_mutex_lock(&fft_cache_lock)
+#define FFT_UNLOCK() pthread_mutex_unlock(&fft_cache_lock)
+#else
+#define FFT_LOCK() ((void)0)
+#define FFT_UNLOCK() ((void)0)
+#endif
+
+/* A plan with one reference and no twiddles yet; NULL if n does not factor
+   or memory is short.  Plans outlive mrb_states, so plain malloc. */
+static struct cmath_fft_plan*
+cmath_fft_plan_new(mrb_int n)
+{
+  struct cmath_fft_plan *plan = (struct cmath_fft_plan*)malloc(sizeof(struct cmath_fft_plan));
+
+  if (plan == NULL) return NULL;
+  if ((uint64_t)n > CMATH_FFT_SIZE_MAX || !cmath_fft_factor(plan, n) ||
+      (plan->twiddle = (mrb_complex*)malloc(n * sizeof(mrb_complex))) == NULL) {
+    free(plan);
+    return NULL;
+  }
+  plan->sub = NULL;
+  plan->chirp = plan->filter = NULL;
+  plan->refs = 1;
+  plan->prev = plan->next = NULL;
+  return plan;
+}
+
+/* Drop a reference, with the lock held */
+static void
+cmath_fft_unref(struct cmath_fft_plan *plan)
+{
+  if (--plan->refs == 0) {
+    if (plan->sub) cmath_fft_unref(plan->sub);
+    free(plan->twiddle);
+    free(plan->chirp);
+    free(plan->filter);
+    free(plan);
+  }
+}
+
+/*
+ * A Bluestein plan for n with one reference, taking over the caller's
+ * reference to sub, a plan of size at least 2n-1; NULL if memory is short.
+ */
+static struct cmath_fft_plan*
+cmath_fft_bluestein_new(mrb_int n, struct cmath_fft_plan *sub)
+{
+  static const double pi = 3.14159265358979323846;
+  struct cmath_fft_plan *plan = (struct cmath_fft_plan*)malloc(sizeof(struct cmath_fft_plan));
+  mrb_int l = sub->n, k, t;
+  mrb_complex *work = (mrb_complex*)malloc(l * sizeof(mrb_complex));
+
+  if (plan) {
+    plan->chirp = (mrb_complex*)malloc(n * sizeof(mrb_complex));
+    plan->filter = (mrb_complex*)malloc(l * sizeof(mrb_complex));
+  }
+  if (plan == NULL || work == NULL || plan->chirp == NULL || plan->filter == NULL) {
+    if (plan) {
+      free(plan->chirp);
+      free(plan->filter);
+    }
+    free(plan);
+    free(work);
+    return NULL;
+  }
+  plan->n = n;
+  plan->nfactors = 0;
+  plan->twiddle = NULL;
+  plan->tstride = 1;
+  plan->sub = sub;
+  plan->refs = 1;
+  plan->prev = plan->next = NULL;
+
+  /* t = k^2 mod 2n, stepped so that it never overflows, taken into (-n, n] */
+  for (k = 0, t = 0; k < n; k++) {
+    double s, c;
+
+    cmath_trig_sincos(-pi*(double)(t > n ? t - 2*n : t)/(double)n, &s, &c);
+    plan->chirp[k] = cmath_build_complex((mrb_float)c, (mrb_float)s);
+    t += 2*k + 1;
+    if (t >= 2*n) t -= 2*n;
+  }
+  for (k = 0; k < l; k++) {
+    plan->filter[k] = 0;
+  }
+  plan->filter[0] = cmath_fft_conj1(plan->chirp[0]);
+  for (k = 1; k < n; k++) {
+    plan->filter[k] = plan->filter[l - k] = cmath_fft_conj1(plan->chirp[k]);
+  }
+  cmath_fft_stockham(sub, plan->filter, work);
+  for (k = 0; k < l; k++) {
+    plan->filter[k] /= (mrb_float)l;
+  }
+  free(work);
+  return plan;
+}
+
+void
+cmath_fft_release(struct cmath_fft_plan *plan)
+{
+  FFT_LOCK();
+  cmath_fft_unref(plan);
+  FFT_UNLOCK();
+}
+
+static void
+cmath_fft_cache_unlink(struct cmath_fft_plan *plan)
+{
+  if (plan->prev) plan->prev->next = plan->next;
+  else fft_cache_head = plan->next;
+  if (plan->next) plan->next->prev = plan->prev;
+  else fft_cache_tail = plan->prev;
+  fft_cache_count--;
+}
+
+static void
+cmath_fft_cache_push(struct cmath_fft_plan *plan)
+{
+  plan->prev = NULL;
+  plan->next = fft_cache_head;
+  if (fft_cache_head) fft_cache_head->prev = plan;
+  else fft_cache_tail = plan;
+  fft_cache_head = plan;
+  fft_cache_count++;
+}
+
+/* The cached plan for n, moved to the front and with a reference added */
+static struct cmath_fft_plan*
+cmath_fft_cache_find(mrb_int n)
+{
+  struct cmath_fft_plan *plan;
+
+  for (plan = fft_cache_head; plan; plan = plan->next) {
+    if (plan->n == n) {
+      cmath_fft_cache_unlink(plan);
+      cmath_fft_cache_push(plan);
+      plan->refs++;
+      return plan;
+    }
+  }
+  return NULL;
+}
+
+/* Add a plan, which the cache takes a reference to, evicting the oldest if full */
+static void
+cmath_fft_cache_insert(struct cmath_fft_plan *plan)
+{
+  plan->refs++;
+  cmath_fft_cache_push(plan);
+  if (fft_cache_count > CMATH_FFT_CACHE_SIZE) {
+    struct cmath_fft_plan *old = fft_cache_tail;
+
+    cmath_fft_cache_unlink(old);
+    cmath_fft_unref(old);
+  }
+}
+
+/* The plan for size n, with a reference for the caller */
+struct cmath_fft_plan*
+cmath_fft_plan_get(mrb_state *mrb, mrb_int n)
+{
+  struct cmath_fft_plan *plan, *found;
+
+  if (n < 1) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "FFT size must be positive");
+  }
+  if ((uint64_t)n > CMATH_FFT_SIZE_MAX) {
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "FFT size %i is too large", n);
+  }
+  FFT_LOCK();
+  plan = cmath_fft_cache_find(n);
+  FFT_UNLOCK();
+  if (plan) {
+    CMATH_STAT(fft, plan_hit);
+    return plan;
+  }
+
+  /* Build it unlocked; another thread may be building the same one */
+  CMATH_STAT(fft, plan_miss);
+  if (cmath_fft_smooth(n)) {
+    plan = cmath_fft_plan_new(n);
+    if (plan) cmath_fft_twiddles(plan->twiddle, n);
+  }
+  else {
+    struct cmath_fft_plan *sub;
+
+    if (n > CMATH_FFT_CHIRP_MAX) {
+      mrb_raisef(mrb, E_ARGUMENT_ERROR, "FFT size %i is too large", n);
+    }
+    sub = cmath_fft_plan_get(mrb, cmath_fft_good_size(2*n - 1));
+    plan = cmath_fft_bluestein_new(n, sub);
+    if (plan == NULL) cmath_fft_release(sub);
+  }
+  if (plan == NULL) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "cannot allocate FFT plan");
+  }
+  FFT_LOCK();
+  found = cmath_fft_cache_find(n);
+  if (found) {
+    cmath_fft_unref(plan);
+    plan = found;
+  }
+  else {
+    cmath_fft_cache_insert(plan);
+  }
+  FFT_UNLOCK();
+  return plan;
+}
+
+/*
+ * Transforms the Buffer v in place with plan, or with the cached plan for
+ * its length if plan is NULL.
+ */
+static mrb_value
+cmath_fft_apply(mrb_state *mrb, mrb_value v, struct cmath_fft_plan *plan, mrb_bool inverse)
+{
+  struct cmath_buffer *buf;
+  mrb_complex *work;
+  mrb_bool cached = plan == NULL;
+
+  if (!cmath_buffer_p(mrb, v)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "CMath::Buffer required");
+  }
+  buf = cmath_buffer_get(mrb, v);
+  cmath_buffer_modify(mrb, buf);
+  if (plan && buf->len != plan->n) {
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "Buffer size %i does not match plan size %i", buf->len, plan->n);
+  }
+  if (buf->len <= 1) return v;
+
+  /* Scratch space in a Buffer, so that the collector reclaims it */
+  work = cmath_buffer_get(mrb, cmath_buffer_new(mrb, cmath_fft_work_size(buf->len)))->ptr;
+  if (cached) plan = cmath_fft_plan_get(mrb, buf->len);
+  if (inverse) cmath_fft_conj(buf->ptr, buf->len, 1.0F);
+  cmath_fft_execute(plan, buf->ptr, work);
+  if (inverse) cmath_fft_conj(buf->ptr, buf->len, 1.0F / (mrb_float)buf->len);
+  if (cached) cmath_fft_release(plan);
+  return v;
+}
+
+/*
+ * FFT.forward(buffer) -> buffer
+ *
+ * Replaces the contents of buffer with its discrete Fourier transform,
+ *   X[k] = sum of x[j]*exp(-2*pi*i*j*k/n) over j < n.
+ * Any length works; products of 2, 3, 5 and 7 are the fastest.
+ */
+static mrb_value
+cmath_fft_forward(mrb_state *mrb, mrb_value self)
+{
+  return cmath_fft_apply(mrb, mrb_get_arg1(mrb), NULL, FALSE);
+}
+
+/*
+ * FFT.inverse(buffer) -> buffer
+ *
+ * The inverse of FFT.forward, scaled by 1/n, in place.
+ */
+static mrb_value
+cmath_fft_inverse(mrb_state *mrb, mrb_value self)
+{
+  return cmath_fft_apply(mrb, mrb_get_arg1(mrb), NULL, TRUE);
+}
+
+static void
+cmath_fft_plan_free(mrb_state *mrb, void *p)
+{
+  if (p) cmath_fft_release((struct cmath_fft_plan*)p);
+}
+
+static const struct mrb_data_type cmath_fft_plan_type = {
+  "CMath::FFT::Plan", cmath_fft_plan_free,
+};
+
+static struct cmath_fft_plan*
+cmath_fft_plan_ptr(mrb_state *mrb, mrb_value self)
+{
+  return DATA_GET_PTR(mrb, self, &cmath_fft_plan_type, struct cmath_fft_plan);
+}
+
+/*
+ * FFT.plan(n) -> CMath::FFT::Plan
+ *
+ * The plan for transforms of length n, from the cache when it is there.
+ * Holding on to it keeps its tables alive after the cache has let go.
+ */
+static mrb_value
+cmath_fft_plan(mrb_state *mrb, mrb_value self)
+{
+  mrb_int n;
+  struct RData *d;
+
+  mrb_get_args(mrb, "i", &n);
+  d = mrb_data_object_alloc(mrb, mrb_class_get_under(mrb, mrb_class_ptr(self), "Plan"),
+                            NULL, &cmath_fft_plan_type);
+  d->data = cmath_fft_plan_get(mrb, n);
+  return mrb_obj_value(d);
+}
+
+/* size: the transform length */
+static mrb_value
+cmath_fft_plan_size(mrb_state *mrb, mrb_value self)
+{
+  return mrb_int_value(mrb, cmath_fft_plan_ptr(mrb, self)->n);
+}
+
+/* forward(buffer): FFT.forward on a Buffer of the plan's size */
+static mrb_value
+cmath_fft_plan_forward(mrb_state *mrb, mrb_value self)
+{
+  return cmath_fft_apply(mrb, mrb_get_arg1(mrb), cmath_fft_plan_ptr(mrb, self), FALSE);
+}
+
+/* inverse(buffer): FFT.inverse on a Buffer of the plan's size */
+static mrb_value
+cmath_fft_plan_inverse(mrb_state *mrb, mrb_value self)
+{
+  return cmath_fft_apply(mrb, mrb_get_arg1(mrb), cmath_fft_plan_ptr(mrb, self), TRUE);
+}
+
+/*
+ * Real transforms of even length n = 2m run a complex transform of
+ * length m over z[k] = x[2k] + i*x[2k+1], which borrows every other
+ * twiddle of the length-n plan, and split the result into the transforms
+ * of the even and odd samples.  Odd lengths, and those that need
+ * Bluestein's algorithm, take the complex path.
+ */
+static void
+cmath_fft_half_plan(struct cmath_fft_plan *half, const struct cmath_fft_plan *plan)
+{
+  cmath_fft_factor(half, plan->n / 2);
+  half->twiddle = plan->twiddle;
+  half->tstride = 2;
+}
+
+/*
+ * z holds the transform of the packed samples in [0, m); replaces it with
+ * bins 0..m of the real transform, using
+ *   E[k] = (Z[k] + conj(Z[m-k]))/2,  O[k] = -i*(Z[k] - conj(Z[m-k]))/2,
+ *   X[k] = E[k] + W^k*O[k],  X[m-k] = conj(E[k] - W^k*O[k]).
+ */
+static void
+cmath_fft_rfft_split(mrb_complex *z, mrb_int m, const mrb_complex *w)
+{
+  mrb_float r0 = cmath_creal(z[0]), i0 = cmath_cimag(z[0]);
+  mrb_int k;
+
+  z[0] = cmath_build_complex(r0 + i0, 0.0F);
+  z[m] = cmath_build_complex(r0 - i0, 0.0F);
+  for (k = 1; 2*k <= m; k++) {
+    mrb_complex a = z[k], b = cmath_build_complex(cmath_creal(z[m - k]), -cmath_cimag(z[m - k]));
+    mrb_complex e = 0.5F*(a + b);
+    mrb_complex o = cmath_fft_mul(cmath_fft_mul_mi(0.5F*(a - b)), w[k]);
+    mrb_complex d = e - o;
+
+    z[k] = e + o;
+    z[m - k] = cmath_build_complex(cmath_creal(d), -cmath_cimag(d));
+  }
+}
+
+/*
+ * The inverse of cmath_fft_rfft_split: from bins 0..m of x, writes the
+ * transform of the packed samples to z[0, m), with
+ *   E[k] = (X[k] + conj(X[m-k]))/2,  O[k] = (X[k] - conj(X[m-k]))*conj(W^k)/2.
+ * The imaginary parts of bins 0 and m are ignored.
+ */
+static void
+cmath_fft_irfft_join(mrb_complex *z, const mrb_complex *x, mrb_int m, const mrb_complex *w)
+{
+  mrb_float r0 = cmath_creal(x[0]), rm = cmath_creal(x[m]);
+  mrb_int k;
+
+  z[0] = cmath_build_complex(0.5F*(r0 + rm), 0.5F*(r0 - rm));
+  for (k = 1; 2*k <= m; k++) {
+    mrb_complex a = x[k], b = cmath_build_complex(cmath_creal(x[m - k]), -cmath_cimag(x[m - k]));
+    mrb_complex e = 0.5F*(a + b);
+    mrb_complex o = cmath_fft_mul(0.5F*(a - b), cmath_build_complex(cmath_creal(w[k]), -cmath_cimag(w[k])));
+
+    /* Z[k] = E[k] + i*O[k], Z[m-k] = conj(E[k]) + i*conj(O[k]) */
+    z[k] = cmath_build_complex(cmath_creal(e) - cmath_cimag(o), cmath_cimag(e) + cmath_creal(o));
+    z[m - k] = cmath_build_complex(cmath_creal(e) + cmath_cimag(o), cmath_creal(o) - cmath_cimag(e));
+  }
+}
+
+static mrb_float
+cmath_fft_real(mrb_state *mrb, mrb_value v)
+{
+  mrb_float real, imag;
+
+  if (cmath_get_complex(mrb, v, &real, &imag) && imag != 0.0F) {
+    mrb_raise(mrb, E_TYPE_ERROR, "real Numeric required");
+  }
+  return real;
+}
+
+/*
+ * FFT.rfft(array) -> CMath::Buffer
+ *
+ * The transform of n real samples: bins 0 to n/2 (rounded down) of
+ * FFT.forward, the rest being their complex conjugates.  Even products
+ * of 2, 3, 5 and 7 cost about half as much as the complex transform.
+ */
+static mrb_value
+cmath_fft_rfft(mrb_state *mrb, mrb_value self)
+{
+  mrb_value ary, result;
+  mrb_complex *out, *work;
+  struct cmath_fft_plan *plan;
+  mrb_int n, i;
+
+  mrb_get_args(mrb, "A", &ary);
+  n = RARRAY_LEN(ary);
+  if (n < 1) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "FFT size must be positive");
+  }
+  result = cmath_buffer_new(mrb, n/2 + 1);
+  out = cmath_buffer_get(mrb, result)->ptr;
+
+  if (n % 2 == 0 && cmath_fft_smooth(n)) {
+    struct cmath_fft_plan half;
+    mrb_int m = n / 2;
+
+    for (i = 0; i < m; i++) {
+      mrb_float re = cmath_fft_real(mrb, mrb_ary_entry(ary, 2*i));
+
+      out[i] = cmath_build_complex(re, cmath_fft_real(mrb, mrb_ary_entry(ary, 2*i + 1)));
+    }
+    work = cmath_buffer_get(mrb, cmath_buffer_new(mrb, m))->ptr;
+    plan = cmath_fft_plan_get(mrb, n);
+    cmath_fft_half_plan(&half, plan);
+    cmath_fft_stockham(&half, out, work);
+    cmath_fft_rfft_split(out, m, plan->twiddle);
+  }
+  else {
+    mrb_complex *x = cmath_buffer_get(mrb, cmath_buffer_new(mrb, n))->ptr;
+
+    for (i = 0; i < n; i++) {
+      x[i] = cmath_build_complex(cmath_fft_real(mrb, mrb_ary_entry(ary, i)), 0.0F);
+    }
+    work = cmath_buffer_get(mrb, cmath_buffer_new(mrb, cmath_fft_work_size(n)))->ptr;
+    plan = cmath_fft_plan_get(mrb, n);
+    cmath_fft_execute(plan, x, work);
+    memcpy(out, x, (n/2 + 1) * sizeof(mrb_complex));
+  }
+  cmath_fft_release(plan);
+  return result;
+}
+
+/*
+ * FFT.irfft(buffer, n = 2*(buffer.size - 1)) -> Array
+ *
+ * The n real samples whose FFT.rfft is buffer, which must hold n/2 + 1
+ * bins; the inverse of rfft, scaled by 1/n.  The imaginary parts of bin 0
+ * and, for even n, bin n/2 are ignored.
+ */
+static mrb_value
+cmath_fft_irfft(mrb_state *mrb, mrb_value self)
+{
+  mrb_value v, result;
+  struct cmath_buffer *buf;
+  struct cmath_fft_plan *plan;
+  mrb_complex *z, *work;
+  mrb_int n, i;
+  mrb_float scale;
+  mrb_bool packed;
+  int ai;
+
+  n = -1;
+  mrb_get_args(mrb, "o|i", &v, &n);
+  if (!cmath_buffer_p(mrb, v)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "CMath::Buffer required");
+  }
+  buf = cmath_buffer_get(mrb, v);
+  if (n == -1) n = 2*(buf->len - 1);
+  if (n < 1) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "FFT size must be positive");
+  }
+  if (buf->len != n/2 + 1) {
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "%i real samples need %i bins, not %i", n, n/2 + 1, buf->len);
+  }
+
+  result = mrb_ary_new_capa(mrb, n);
+  z = cmath_buffer_get(mrb, cmath_buffer_new(mrb, n))->ptr;
+  work = cmath_buffer_get(mrb, cmath_buffer_new(mrb, cmath_fft_work_size(n)))->ptr;
+  plan = cmath_fft_plan_get(mrb, n);
+  packed = n % 2 == 0 && cmath_fft_smooth(n);
+  if (packed) {
+    struct cmath_fft_plan half;
+    mrb_int m = n / 2;
+
+    cmath_fft_half_plan(&half, plan);
+    cmath_fft_irfft_join(z, buf->ptr, m, plan->twiddle);
+    cmath_fft_conj(z, m, 1.0F);
+    cmath_fft_stockham(&half, z, work);
+    scale = 1.0F / (mrb_float)m;
+  }
+  else {
+    /* The whole Hermitian spectrum */
+    z[0] = cmath_build_complex(cmath_creal(buf->ptr[0]), 0.0F);
+    for (i = 1; i < buf->len; i++) {
+      z[i] = cmath_build_complex(cmath_creal(buf->ptr[i]), -cmath_cimag(buf->ptr[i]));
+      z[n - i] = buf->ptr[i];
+    }
+    if (n % 2 == 0) {
+      z[n/2] = cmath_build_complex(cmath_creal(buf->ptr[n/2]), 0.0F);
+    }
+    cmath_fft_execute(plan, z, work);
+    scale = 1.0F / (mrb_float)n;
+  }
+  cmath_fft_release(plan);
+
+  /* Both paths leave conj(x) unscaled; only the real parts are wanted */
+  ai = mrb_gc_arena_save(mrb);
+  for (i = 0; i < n; i++) {
+    mrb_float x = packed ? (i % 2 == 0 ? cmath_creal(z[i/2]) : -cmath_cimag(z[i/2])) : cmath_creal(z[i]);
+
+    mrb_ary_push(mrb, result, mrb_float_value(mrb, x*scale));
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  return result;
+}
+
+/*
+ * Batches.  cmath_parallel_for hands out ranges of elements, so a batch
+ * of items (frames, or rows of transpose tiles) gives each item `unit`
+ * elements of the range, and a task takes the items that start inside
+ * its share.
+ */
+static void
+cmath_fft_items(mrb_int begin, mrb_int end, mrb_int unit, mrb_int *first, mrb_int *last)
+{
+  *first = (begin + unit - 1) / unit;
+  *last = (end + unit - 1) / unit;
+}
+
+/* count frames of plan->n elements, element j of frame f at f*dist + j*stride */
+struct cmath_fft_batch {
+  struct cmath_fft_plan *plan;
+  mrb_complex *data;
+  mrb_int count, stride, dist;
+  mrb_bool inverse;
+  int failed;           /* a task could not allocate its scratch space */
+};
+
+static void
+cmath_fft_batch_run(void *arg, mrb_int begin, mrb_int end)
+{
+  struct cmath_fft_batch *b = (struct cmath_fft_batch*)arg;
+  mrb_int n = b->plan->n, f, first, last, j;
+  mrb_complex *work, *frame;
+
+  cmath_fft_items(begin, end, n, &first, &last);
+  if (first >= last) return;
+  /* Worker threads have no mrb_state to allocate from */
+  work = (mrb_complex*)malloc((cmath_fft_work_size(n) + (b->stride != 1 ? n : 0)) * sizeof(mrb_complex));
+  if (work == NULL) {
+    __atomic_store_n(&b->failed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  for (f = first; f < last; f++) {
+    if (b->stride == 1) {
+      frame = b->data + f*b->dist;
+    }
+    else {
+      frame = work + cmath_fft_work_size(n);
+      for (j = 0; j < n; j++) {
+        frame[j] = b->data[f*b->dist + j*b->stride];
+      }
+    }
+    if (b->inverse) cmath_fft_conj(frame, n, 1.0F);
+    cmath_fft_execute(b->plan, frame, work);
+    if (b->inverse) cmath_fft_conj(frame, n, 1.0F / (mrb_float)n);
+    if (b->stride != 1) {
+      for (j = 0; j < n; j++) {
+        b->data[f*b->dist + j*b->stride] = frame[j];
+      }
+    }
+  }
+  free(work);
+}
+
+/* Runs the batch, in parallel when it is large; false if scratch space ran out */
+static mrb_bool
+cmath_fft_batch(struct cmath_fft_batch *b)
+{
+  b->failed = 0;
+  cmath_parallel_for(b->count * b->plan->n, cmath_fft_batch_run, b);
+  return !b->failed;
+}
+
+/* Tiles of the transposes; 16x16 complex doubles are 4 KB */
+#ifndef CMATH_FFT_TILE
+#define CMATH_FFT_TILE 16
+#endif
+
+/* count matrices of rows x cols in src, transposed into dst */
+struct cmath_fft_transpose {
+  mrb_complex *dst;
+  const mrb_complex *src;
+  mrb_int rows, cols, tiles;    /* tile rows per matrix */
+};
+
+static void
+cmath_fft_transpose_run(void *arg, mrb_int begin, mrb_int end)
+{
+  struct cmath_fft_transpose *t = (struct cmath_fft_transpose*)arg;
+  mrb_int rows = t->rows, cols = t->cols, g, first, last, i, j, j0;
+
+  cmath_fft_items(begin, end, CMATH_FFT_TILE*cols, &first, &last);
+  for (g = first; g < last; g++) {
+    mrb_int size = rows*cols;
+    const mrb_complex *src = t->src + (g / t->tiles)*size;
+    mrb_complex *dst = t->dst + (g / t->tiles)*size;
+    mrb_int i0 = (g % t->tiles)*CMATH_FFT_TILE;
+    mrb_int i1 = i0 + CMATH_FFT_TILE < rows ? i0 + CMATH_FFT_TILE : rows;
+
+    for (j0 = 0; j0 < cols; j0 += CMATH_FFT_TILE) {
+      mrb_int j1 = j0 + CMATH_FFT_TILE < cols ? j0 + CMATH_FFT_TILE : cols;
+
+      for (i = i0; i < i1; i++) {
+        for (j = j0; j < j1; j++) {
+          dst[j*rows + i] = src[i*cols + j];
+        }
+      }
+    }
+  }
+}
+
+static void
+cmath_fft_transpose(mrb_complex *dst, const mrb_complex *src, mrb_int count, mrb_int rows, mrb_int cols)
+{
+  struct cmath_fft_transpose t;
+
+  t.dst = dst;
+  t.src = src;
+  t.rows = rows;
+  t.cols = cols;
+  t.tiles = (rows + CMATH_FFT_TILE - 1) / CMATH_FFT_TILE;
+  cmath_parallel_for(count * t.tiles * CMATH_FFT_TILE*cols, cmath_fft_transpose_run, &t);
+}
+
+/*
+ * Transforms the row-major array data along each of its nd axes, last
+ * first.  Along the last axis the rows are contiguous frames; for any
+ * other axis each block of dims[d] x (product of later dims) elements is
+ * transposed into tmp, so that the transforms again run over contiguous
+ * frames, and transposed back.
+ */
+static void
+cmath_fft_nd(mrb_state *mrb, mrb_complex *data, mrb_complex *tmp, mrb_int total,
+             const mrb_int *dims, int nd, mrb_bool inverse)
+{
+  struct cmath_fft_batch b;
+  mrb_int inner = 1;
+  int d;
+
+  for (d = nd - 1; d >= 0; d--) {
+    mrb_int n = dims[d];
+    mrb_int outer = total / (n*inner);
+    mrb_bool ok;
+
+    if (n > 1) {
+      b.plan = cmath_fft_plan_get(mrb, n);
+      b.stride = 1;
+      b.dist = n;
+      b.count = outer*inner;
+      b.inverse = inverse;
+      if (inner == 1) {
+        b.data = data;
+        ok = cmath_fft_batch(&b);
+      }
+      else {
+        b.data = tmp;
+        cmath_fft_transpose(tmp, data, outer, n, inner);
+        ok = cmath_fft_batch(&b);
+        cmath_fft_transpose(data, tmp, outer, inner, n);
+      }
+      cmath_fft_release(b.plan);
+      if (!ok) {
+        mrb_raise(mrb, E_RUNTIME_ERROR, "cannot allocate FFT scratch space");
+      }
+    }
+    inner *= n;
+  }
+}
+
+static mrb_value
+cmath_fft_apply_nd(mrb_state *mrb, int nd, mrb_bool inverse)
+{
+  mrb_value v;
+  mrb_int dims[3], total = 1;
+  struct cmath_buffer *buf;
+  mrb_complex *tmp;
+  int d;
+
+  if (nd == 2) mrb_get_args(mrb, "oii", &v, &dims[0], &dims[1]);
+  else mrb_get_args(mrb, "oiii", &v, &dims[0], &dims[1], &dims[2]);
+  if (!cmath_buffer_p(mrb, v)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "CMath::Buffer required");
+  }
+  buf = cmath_buffer_get(mrb, v);
+  cmath_buffer_modify(mrb, buf);
+  for (d = 0; d < nd; d++) {
+    if (dims[d] < 1 || dims[d] > buf->len / total) {
+      total = -1;
+      break;
+    }
+    total *= dims[d];
+  }
+  if (total != buf->len) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "dimensions do not match the Buffer size");
+  }
+  tmp = cmath_buffer_get(mrb, cmath_buffer_new(mrb, buf->len))->ptr;
+  cmath_fft_nd(mrb, buf->ptr, tmp, buf->len, dims, nd, inverse);
+  return v;
+}
+
+/*
+ * FFT.forward2(buffer, rows, cols) -> buffer
+ * FFT.inverse2(buffer, rows, cols) -> buffer
+ *
+ * Two-dimensional transforms of a rows x cols array stored row by row,
+ * in place; the inverse is scaled by 1/(rows*cols).
+ */
+static mrb_value
+cmath_fft_forward2(mrb_state *mrb, mrb_value self)
+{
+  return cmath_fft_apply_nd(mrb, 2, FALSE);
+}
+
+static mrb_value
+cmath_fft_inverse2(mrb_state *mrb, mrb_value self)
+{
+  return cmath_fft_apply_nd(mrb, 2, TRUE);
+}
+
+/*
+ * FFT.forward3(buffer, n0, n1, n2) -> buffer
+ * FFT.inverse3(buffer, n0, n1, n2) -> buffer
+ *
+ * Three-dimensional transforms of an n0 x n1 x n2 array, the last index
+ * varying fastest, in place.
+ */
+static mrb_value
+cmath_fft_forward3(mrb_state *mrb, mrb_value self)
+{
+  return cmath_fft_apply_nd(mrb, 3, FALSE);
+}
+
+static mrb_value
+cmath_fft_inverse3(mrb_state *mrb, mrb_value self)
+{
+  return cmath_fft_apply_nd(mrb, 3, TRUE);
+}
+
+static mrb_value
+cmath_fft_apply_many(mrb_state *mrb, mrb_bool inverse)
+{
+  mrb_value v;
+  mrb_int n, stride = 1, dist = -1, span;
+  struct cmath_buffer *buf;
+  struct cmath_fft_batch b;
+  mrb_bool ok;
+
+  mrb_get_args(mrb, "oi|ii", &v, &n, &stride, &dist);
+  if (!cmath_buffer_p(mrb, v)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "CMath::Buffer required");
+  }
+  buf = cmath_buffer_get(mrb, v);
+  cmath_buffer_modify(mrb, buf);
+  if (n < 1 || stride < 1 || buf->len < 1 || n - 1 > (buf->len - 1) / stride) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "frame does not fit in the Buffer");
+  }
+  span = (n - 1)*stride + 1;
+  if (dist == -1) dist = n*stride;
+  if (dist < 1) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "frame distance must be positive");
+  }
+  b.count = (buf->len - span) / dist + 1;
+  /* Frames run concurrently, so they must not share elements: either
+     each lies before the next, or all start within one stride */
+  if (dist < span && (b.count - 1)*dist >= stride) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "frames overlap");
+  }
+  if (n == 1) return v;
+
+  b.plan = cmath_fft_plan_get(mrb, n);
+  b.data = buf->ptr;
+  b.stride = stride;
+  b.dist = dist;
+  b.inverse = inverse;
+  ok = cmath_fft_batch(&b);
+  cmath_fft_release(b.plan);
+  if (!ok) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "cannot allocate FFT scratch space");
+  }
+  return v;
+}
+
+/*
+ * FFT.forward_many(buffer, n, stride = 1, dist = n*stride) -> buffer
+ * FFT.inverse_many(buffer, n, stride = 1, dist = n*stride) -> buffer
+ *
+ * Transforms, in place, every frame of length n that fits in buffer:
+ * element j of frame f is buffer[f*dist + j*stride].  The frames are
+ * spread over the worker threads.
+ */
+static mrb_value
+cmath_fft_forward_many(mrb_state *mrb, mrb_value self)
+{
+  return cmath_fft_apply_many(mrb, FALSE);
+}
+
+static mrb_value
+cmath_fft_inverse_many(mrb_state *mrb, mrb_value self)
+{
+  return cmath_fft_apply_many(mrb, TRUE);
+}
+
+/* log(c) in double, for the powers in czt; raises if c is zero */
+static void
+cmath_fft_log_arg(mrb_state *mrb, mrb_value v, double *re, double *im)
+{
+  mrb_float r, i;
+
+  cmath_get_complex(mrb, v, &r, &i);
+  if (r == 0.0F && i == 0.0F) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "czt needs nonzero w and a");
+  }
+  *re = log(hypot((double)r, (double)i));
+  *im = atan2((double)i, (double)r);
+}
+
+/*
+ * The phase of w**(k^2/2), given lwi = arg(w).  For the default w =
+ * exp(-2*pi*i/n), pass n, and k^2 is reduced modulo 2n exactly first.
+ */
+static double
+cmath_fft_czt_phase(mrb_int k, double lwi, mrb_int n)
+{
+  static const double pi = 3.14159265358979323846;
+
+  if (n > 0 && (uint64_t)k < 0x100000000ULL) {
+    int64_t q = (int64_t)((uint64_t)k*(uint64_t)k % (uint64_t)(2*n));
+
+    return -pi*(double)(q > n ? q - 2*n : q)/(double)n;
+  }
+  return 0.5*(double)k*(double)k*lwi;
+}
+
+/*
+ * CMath.czt(buffer, m = buffer.size, w = exp(-2*pi*i/buffer.size), a = 1) -> CMath::Buffer
+ *
+ * The chirp z-transform: the m values
+ *   X[k] = sum of x[j]*a**-j*w**(j*k) over j < buffer.size,
+ * which sample the z-transform of x along the spiral a*w**-k.  With w =
+ * exp(-2*pi*i*d) and a = exp(2*pi*i*f) it zooms into the spectrum from
+ * frequency f in steps of d; with the defaults it is FFT.forward.
+ */
+static mrb_value
+cmath_czt(mrb_state *mrb, mrb_value self)
+{
+  static const double two_pi = 6.28318530717958647693;
+  mrb_value v, wv = mrb_nil_value(), av = mrb_nil_value(), result, scratch;
+  struct cmath_buffer *buf;
+  struct cmath_fft_plan *sub;
+  mrb_complex *pre, *post, *filter, *work;
+  mrb_int m = -1, n, l, k, unit;
+  double lwr, lwi, lar = 0.0, lai = 0.0;
+
+  mrb_get_args(mrb, "o|ioo", &v, &m, &wv, &av);
+  if (!cmath_buffer_p(mrb, v)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "CMath::Buffer required");
+  }
+  buf = cmath_buffer_get(mrb, v);
+  n = buf->len;
+  if (m == -1) m = n;
+  if (n < 1 || m < 1) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "czt needs a nonempty buffer and m > 0");
+  }
+  if (n > CMATH_FFT_CHIRP_MAX || m > CMATH_FFT_CHIRP_MAX - n + 1) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "czt size is too large");
+  }
+  if (mrb_nil_p(wv)) {
+    lwr = 0.0;
+    lwi = -two_pi/(double)n;
+    unit = n;
+  }
+  else {
+    cmath_fft_log_arg(mrb, wv, &lwr, &lwi);
+    unit = 0;
+  }
+  if (!mrb_nil_p(av)) cmath_fft_log_arg(mrb, av, &lar, &lai);
+
+  l = cmath_fft_good_size(n + m - 1);
+  result = cmath_buffer_new(mrb, m);
+  scratch = cmath_buffer_new(mrb, n + m + 3*l);
+  pre = cmath_buffer_get(mrb, scratch)->ptr;
+  post = pre + n;
+  filter = post + m;
+  work = filter + l;
+
+  /* w**(j*k) = w**(j^2/2) * w**(k^2/2) * w**(-(k-j)^2/2) */
+  for (k = 0; k < n; k++) {
+    double t = 0.5*(double)k*(double)k;
+
+    pre[k] = cmath_fft_cexp(t*lwr - (double)k*lar, cmath_fft_czt_phase(k, lwi, unit) - (double)k*lai);
+  }
+  for (k = 0; k < m; k++) {
+    double t = 0.5*(double)k*(double)k;
+    double phase = cmath_fft_czt_phase(k, lwi, unit);
+
+    post[k] = cmath_fft_cexp(t*lwr, phase);
+    filter[k] = cmath_fft_cexp(-t*lwr, -phase);
+  }
+  for (; k <= l - n; k++) {
+    filter[k] = 0;
+  }
+  for (k = 1; k < n; k++) {
+    double t = 0.5*(double)k*(double)k;
+
+    filter[l - k] = cmath_fft_cexp(-t*lwr, -cmath_fft_czt_phase(k, lwi, unit));
+  }
+
+  sub = cmath_fft_plan_get(mrb, l);
+  cmath_fft_stockham(sub, filter, work);
+  for (k = 0; k < l; k++) {
+    filter[k] /= (mrb_float)l;
+  }
+  cmath_fft_chirp(sub, filter, buf->ptr, pre, n, cmath_buffer_get(mrb, result)->ptr, post, m, work);
+  cmath_fft_release(sub);
+  return result;
+}
+
+/*
+ * Wisdom: the magic, a version and sizeof(mrb_float) as uint32_t, then
+ * for each plan its size as int64_t and its twiddle table, all in the
+ * native byte order.  Only a build like the one that wrote it can read it.
+ */
+static const char cmath_fft_wisdom_magic[8] = { 'C', 'M', 'A', 'T', 'H', 'F', 'F', 'T' };
+#define CMATH_FFT_WISDOM_VERSION 1
+#define CMATH_FFT_WISDOM_HEADER (sizeof(cmath_fft_wisdom_magic) + 2*sizeof(uint32_t))
+
+/*
+ * True if the table of size n at p, unaligned, holds what
+ * cmath_fft_twiddles computes, judged from a few entries
+ */
+static mrb_bool
+cmath_fft_wisdom_check(const char *p, mrb_int n)
+{
+  mrb_int probe[4];
+  int i;
+
+  probe[0] = 1 % n;
+  probe[1] = n / 4;
+  probe[2] = n / 3;
+  probe[3] = n - 1;
+  for (i = 0; i < 4; i++) {
+    mrb_complex w = cmath_fft_twiddle(n, probe[i]);
+
+    if (memcmp(p + probe[i]*sizeof(mrb_complex), &w, sizeof(w)) != 0) return FALSE;
+  }
+  return TRUE;
+}
+
+/*
+ * Reads the plans in wisdom p[0, len) into the cache, keeping any plan of
+ * the same size already there; returns how many, or -1 with *err set if
+ * any of it is not wisdom from this build, in which case nothing is read.
+ */
+static int
+cmath_fft_wisdom_read(const char *p, size_t len, const char **err)
+{
+  uint32_t header[2];
+  size_t pos;
+  int64_t n;
+  int count = 0;
+  int pass;
+
+  if (len < CMATH_FFT_WISDOM_HEADER || memcmp(p, cmath_fft_wisdom_magic, sizeof(cmath_fft_wisdom_magic)) != 0) {
+    *err = "not FFT wisdom";
+    return -1;
+  }
+  memcpy(header, p + sizeof(cmath_fft_wisdom_magic), sizeof(header));
+  if (header[0] != CMATH_FFT_WISDOM_VERSION || header[1] != sizeof(mrb_float)) {
+    *err = "FFT wisdom from another build";
+    return -1;
+  }
+
+  /* Check every table first, then install them */
+  for (pass = 0; pass < 2; pass++) {
+    for (pos = CMATH_FFT_WISDOM_HEADER; pos < len; pos += sizeof(n) + (size_t)n*sizeof(mrb_complex)) {
+      struct cmath_fft_plan *plan, *found;
+
+      if (len - pos < sizeof(n)) {
+        *err = "truncated FFT wisdom";
+        return -1;
+      }
+      memcpy(&n, p + pos, sizeof(n));
+      if (n < 1 || n > MRB_INT_MAX || (uint64_t)n > CMATH_FFT_SIZE_MAX || !cmath_fft_smooth((mrb_int)n)) {
+        *err = "bad plan in FFT wisdom";
+        return -1;
+      }
+      if ((uint64_t)(len - pos - sizeof(n)) / sizeof(mrb_complex) < (uint64_t)n) {
+        *err = "truncated FFT wisdom";
+        return -1;
+      }
+      if (pass == 0) {
+        if (!cmath_fft_wisdom_check(p + pos + sizeof(n), (mrb_int)n)) {
+          *err = "FFT wisdom does not match this build's tables";
+          return -1;
+        }
+        continue;
+      }
+
+      plan = cmath_fft_plan_new((mrb_int)n);
+      if (plan == NULL) {
+        *err = "cannot allocate FFT plan";
+        return -1;
+      }
+      memcpy(plan->twiddle, p + pos + sizeof(n), (size_t)n*sizeof(mrb_complex));
+      FFT_LOCK();
+      found = cmath_fft_cache_find(plan->n);
+      if (found) {
+        cmath_fft_unref(found);
+      }
+      else {
+        cmath_fft_cache_insert(plan);
+      }
+      cmath_fft_unref(plan);
+      FFT_UNLOCK();
+      count++;
+    }
+  }
+  return count;
+}
+
+/*
+ * FFT.export_wisdom -> String
+ *
+ * The tables of the cached plans, oldest first, as import_wisdom reads
+ * them back.
+ */
+static mrb_value
+cmath_fft_export_wisdom(mrb_state *mrb, mrb_value self)
+{
+  uint32_t header[2] = { CMATH_FFT_WISDOM_VERSION, sizeof(mrb_float) };
+  struct cmath_fft_plan *plan;
+  size_t len = CMATH_FFT_WISDOM_HEADER, pos;
+  mrb_value str;
+  char *p;
+
+  /* Size it, then copy under the lock whatever of the cache still fits */
+  FFT_LOCK();
+  for (plan = fft_cache_tail; plan; plan = plan->prev) {
+    /* Bluestein plans are rebuilt quickly from their cached sub-plans */
+    if (plan->sub) continue;
+    len += sizeof(int64_t) + plan->n*sizeof(mrb_complex);
+  }
+  FFT_UNLOCK();
+  str = mrb_str_new(mrb, NULL, (mrb_int)len);
+  p = RSTRING_PTR(str);
+  memcpy(p, cmath_fft_wisdom_magic, sizeof(cmath_fft_wisdom_magic));
+  memcpy(p + sizeof(cmath_fft_wisdom_magic), header, sizeof(header));
+  pos = CMATH_FFT_WISDOM_HEADER;
+  FFT_LOCK();
+  for (plan = fft_cache_tail; plan; plan = plan->prev) {
+    int64_t n = plan->n;
+    size_t size = sizeof(n) + plan->n*sizeof(mrb_complex);
+
+    if (plan->sub || size > len - pos) continue;
+    memcpy(p + pos, &n, sizeof(n));
+    memcpy(p + pos + sizeof(n), plan->twiddle, plan->n*sizeof(mrb_complex));
+    pos += size;
+  }
+  FFT_UNLOCK();
+  mrb_str_resize(mrb, str, (mrb_int)pos);
+  return str;
+}
+
+/*
+ * FFT.import_wisdom(string) -> Integer
+ *
+ * Reads plans exported by export_wisdom into the cache, keeping any plan
+ * of the same size already there; returns how many were read.  Raises
+ * RuntimeError, and reads none, unless every table is what this build
+ * computes.
+ */
+static mrb_value
+cmath_fft_import_wisdom(mrb_state *mrb, mrb_value self)
+{
+  const char *err = NULL;
+  char *p;
+  mrb_int len;
+  int count;
+
+  mrb_get_args(mrb, "s", &p, &len);
+  count = cmath_fft_wisdom_read(p, (size_t)len, &err);
+  if (count < 0) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, err);
+  }
+  return mrb_int_value(mrb, count);
+}
+
+#ifndef MRB_NO_STDIO
+
+/*
+ * FFT.save_wisdom(path) -> Integer
+ *
+ * Writes export_wisdom to path; returns how many plans it holds.
+ */
+static mrb_value
+cmath_fft_save_wisdom(mrb_state *mrb, mrb_value self)
+{
+  const char *path;
+  mrb_value str;
+  int64_t n;
+  size_t pos, len;
+  int count = 0;
+  mrb_bool ok;
+  FILE *f;
+
+  mrb_get_args(mrb, "z", &path);
+  str = cmath_fft_export_wisdom(mrb, self);
+  len = (size_t)RSTRING_LEN(str);
+  for (pos = CMATH_FFT_WISDOM_HEADER; pos < len; pos += sizeof(n) + (size_t)n*sizeof(mrb_complex)) {
+    memcpy(&n, RSTRING_PTR(str) + pos, sizeof(n));
+    count++;
+  }
+
+  f = fopen(path, "wb");
+  if (f == NULL) mrb_sys_fail(mrb, path);
+  ok = fwrite(RSTRING_PTR(str), 1, len, f) == len;
+  if (fclose(f) != 0) ok = FALSE;
+  if (!ok) mrb_sys_fail(mrb, path);
+  return mrb_int_value(mrb, count);
+}
+
+/*
+ * FFT.load_wisdom(path) -> Integer
+ *
+ * import_wisdom on the contents of path.
+ */
+static mrb_value
+cmath_fft_load_wisdom(mrb_state *mrb, mrb_value self)
+{
+  const char *path;
+  const char *err = NULL;
+  char *p = NULL, *q;
+  size_t len = 0, cap = 0, got;
+  int count;
+  FILE *f;
+
+  mrb_get_args(mrb, "z", &path);
+  f = fopen(path, "rb");
+  if (f == NULL) mrb_sys_fail(mrb, path);
+
+  /* Plain malloc, so that nothing raises while the file is open */
+  do {
+    if (len == cap) {
+      cap = cap ? 2*cap : 65536;
+      q = (char*)realloc(p, cap);
+      if (q == NULL) {
+        err = "cannot allocate FFT wisdom";
+        break;
+      }
+      p = q;
+    }
+    got = fread(p + len, 1, cap - len, f);
+    len += got;
+  } while (got > 0);
+  if (err == NULL && ferror(f)) err = "cannot read FFT wisdom";
+  fclose(f);
+
+  count = err ? -1 : cmath_fft_wisdom_read(p, len, &err);
+  free(p);
+  if (count < 0) {
+    mrb_raisef(mrb, E_RUNTIME_ERROR, "%s: %s", err, path);
+  }
+  return mrb_int_value(mrb, count);
+}
+
+#endif  /* MRB_NO_STDIO */
+
+void
+cmath_fft_init(mrb_state *mrb, struct RClass *cmath)
+{
+  struct RClass *fft = mrb_define_module_under(mrb, cmath, "FFT");
+  struct RClass *plan;
+
+  mrb_define_module_function(mrb, fft, "forward", cmath_fft_forward, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, fft, "inverse", cmath_fft_inverse, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, fft, "plan", cmath_fft_plan, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, fft, "rfft", cmath_fft_rfft, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, fft, "irfft", cmath_fft_irfft, MRB_ARGS_ARG(1,1));
+  mrb_define_module_function(mrb, fft, "export_wisdom", cmath_fft_export_wisdom, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, fft, "import_wisdom", cmath_fft_import_wisdom, MRB_ARGS_REQ(1));
+#ifndef MRB_NO_STDIO
+  mrb_define_module_function(mrb, fft, "save_wisdom", cmath_fft_save_wisdom, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, fft, "load_wisdom", cmath_fft_load_wisdom, MRB_ARGS_REQ(1));
+#endif
+
+  mrb_define_module_function(mrb, fft, "forward2", cmath_fft_forward2, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, fft, "inverse2", cmath_fft_inverse2, MRB_ARGS_REQ(3));
+  mrb_define_module_function(mrb, fft, "forward3", cmath_fft_forward3, MRB_ARGS_REQ(4));
+  mrb_define_module_function(mrb, fft, "inverse3", cmath_fft_inverse3, MRB_ARGS_REQ(4));
+  mrb_define_module_function(mrb, fft, "forward_many", cmath_fft_forward_many, MRB_ARGS_ARG(2,2));
+  mrb_define_module_function(mrb, fft, "inverse_many", cmath_fft_inverse_many, MRB_ARGS_ARG(2,2));
+  mrb_define_module_function(mrb, cmath, "czt", cmath_czt, MRB_ARGS_ARG(1,3));
+
+  plan = mrb_define_class_under(mrb, fft, "Plan", mrb->object_class);
+  MRB_SET_INSTANCE_TT(plan, MRB_TT_CDATA);
+  mrb_undef_class_method(mrb, plan, "new");
+  mrb_define_method(mrb, plan, "size", cmath_fft_plan_size, MRB_ARGS_NONE());
+  mrb_define_method(mrb, plan, "forward", cmath_fft_plan_forward, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, plan, "inverse", cmath_fft_plan_inverse, MRB_ARGS_REQ(1));
+}
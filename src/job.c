@@ -0,0 +1,175 @@
+/*
+** job.c - CMath::Job, batch evaluation in the background
+**
+** See Copyright Notice in mruby.h
+*/
+
+#include <mruby.h>
+#include <mruby/class.h>
+#include <mruby/data.h>
+#include <mruby/variable.h>
+#include "cmath.h"
+
+#ifdef CMATH_USE_PTHREAD
+#include <pthread.h>
+#endif
+
+/*
+ * A job holds a reference to its input and output storage, so both
+ * outlive their Buffer objects if those are collected first; the input
+ * cannot be modified until the job has been joined.  The background
+ * thread touches only the two arrays and `done`, never the mrb_state.
+ */
+struct cmath_job {
+  const struct cmath_func *f;
+  struct cmath_buffer *src;
+  struct cmath_buffer *dst;
+  int done;             /* set by the background thread when finished */
+  int joined;           /* thread joined and references dropped */
+#ifdef CMATH_USE_PTHREAD
+  pthread_t thread;
+#endif
+};
+
+static void
+cmath_job_run(struct cmath_job *job)
+{
+  cmath_apply_buffer(job->f, job->dst->ptr, job->src->ptr, job->src->len);
+  __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+}
+
+#ifdef CMATH_USE_PTHREAD
+static void*
+cmath_job_thread(void *p)
+{
+  cmath_job_run((struct cmath_job*)p);
+  return NULL;
+}
+#endif
+
+/* Wait for the job to finish and unpin its buffers */
+static void
+cmath_job_join(mrb_state *mrb, struct cmath_job *job)
+{
+  if (job->joined) return;
+#ifdef CMATH_USE_PTHREAD
+  pthread_join(job->thread, NULL);
+#endif
+  job->joined = 1;
+  cmath_buffer_release(mrb, job->src);
+  cmath_buffer_release(mrb, job->dst);
+}
+
+static void
+cmath_job_free(mrb_state *mrb, void *p)
+{
+  struct cmath_job *job = (struct cmath_job*)p;
+
+  if (job) {
+    /* The thread may still be writing the output */
+    cmath_job_join(mrb, job);
+    mrb_free(mrb, job);
+  }
+}
+
+static const struct mrb_data_type cmath_job_type = {
+  "CMath::Job", cmath_job_free,
+};
+
+/*
+ * async(name, buffer) -> CMath::Job
+ *
+ * Starts name_all(buffer) on a background thread, for one of the
+ * element-wise functions such as :exp or :sqrt.  The buffer cannot be
+ * modified until the job is finished and has been waited for.  Without
+ * thread support, the work is done before async returns.
+ */
+static mrb_value
+cmath_async(mrb_state *mrb, mrb_value self)
+{
+  mrb_sym name;
+  mrb_value input, output;
+  const struct cmath_func *f;
+  struct cmath_buffer *src;
+  struct cmath_job *job;
+  struct RData *d;
+
+  mrb_get_args(mrb, "no", &name, &input);
+  f = cmath_func_find(mrb, name);
+  if (f == NULL) {
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "unknown CMath function: %n", name);
+  }
+  if (!cmath_buffer_p(mrb, input)) {
+    mrb_raise(mrb, E_TYPE_ERROR, "CMath::Buffer required");
+  }
+  src = cmath_buffer_get(mrb, input);
+  output = cmath_buffer_new(mrb, src->len);
+
+  d = mrb_data_object_alloc(mrb, mrb_class_get_under(mrb, mrb_module_get(mrb, "CMath"), "Job"),
+                            NULL, &cmath_job_type);
+  mrb_iv_set(mrb, mrb_obj_value(d), mrb_intern_lit(mrb, "__output__"), output);
+  job = (struct cmath_job*)mrb_malloc(mrb, sizeof(struct cmath_job));
+  job->f = f;
+  job->src = src;
+  job->dst = cmath_buffer_get(mrb, output);
+  job->done = 0;
+  job->joined = 0;
+  src->refs++;
+  job->dst->refs++;
+  d->data = job;
+
+#ifdef CMATH_USE_PTHREAD
+  if (pthread_create(&job->thread, NULL, cmath_job_thread, job) != 0) {
+    /* No thread to be had; do the work now */
+    cmath_job_run(job);
+    job->joined = 1;
+    cmath_buffer_release(mrb, job->src);
+    cmath_buffer_release(mrb, job->dst);
+  }
+#else
+  cmath_job_run(job);
+  cmath_job_join(mrb, job);
+#endif
+  return mrb_obj_value(d);
+}
+
+static struct cmath_job*
+cmath_job_get(mrb_state *mrb, mrb_value self)
+{
+  return DATA_GET_PTR(mrb, self, &cmath_job_type, struct cmath_job);
+}
+
+/* done?: true once the result is ready; never blocks */
+static mrb_value
+cmath_job_done_p(mrb_state *mrb, mrb_value self)
+{
+  struct cmath_job *job = cmath_job_get(mrb, self);
+
+  if (!job->joined && !__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) {
+    return mrb_false_value();
+  }
+  cmath_job_join(mrb, job);
+  return mrb_true_value();
+}
+
+/* wait: block until the job is finished, and return its output Buffer */
+static mrb_value
+cmath_job_wait(mrb_state *mrb, mrb_value self)
+{
+  cmath_job_join(mrb, cmath_job_get(mrb, self));
+  return mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__output__"));
+}
+
+void
+cmath_job_init(mrb_state *mrb, struct RClass *cmath)
+{
+  struct RClass *job;
+
+  job = mrb_define_class_under(mrb, cmath, "Job", mrb->object_class);
+  MRB_SET_INSTANCE_TT(job, MRB_TT_CDATA);
+  mrb_undef_class_method(mrb, job, "new");
+
+  mrb_define_method(mrb, job, "done?", cmath_job_done_p, MRB_ARGS_NONE());
+  mrb_define_method(mrb, job, "wait", cmath_job_wait, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, cmath, "async", cmath_async, MRB_ARGS_REQ(2));
+}
@@ -0,0 +1,339 @@
+/*
+** pool.c - worker threads for batch evaluation over CMath::Buffer
+**
+** See Copyright Notice in mruby.h
+*/
+
+#include <mruby.h>
+#include "cmath.h"
+
+/* Batches shorter than this run on the calling thread */
+#ifndef CMATH_PARALLEL_THRESHOLD
+#define CMATH_PARALLEL_THRESHOLD 4096
+#endif
+
+/* Smallest share of a batch handed to one thread */
+#ifndef CMATH_PARALLEL_MIN_CHUNK
+#define CMATH_PARALLEL_MIN_CHUNK 1024
+#endif
+
+/* Smallest unit of work that can be stolen */
+#ifndef CMATH_PARALLEL_GRAIN
+#define CMATH_PARALLEL_GRAIN 256
+#endif
+
+#define CMATH_MAX_THREADS 1024
+
+#ifdef CMATH_USE_PTHREAD
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * The pool is shared by every mrb_state in the process.  pool_submit
+ * admits one batch at a time; a batch that finds it taken, say by a
+ * CMath::Job, runs serially on its own thread instead of waiting for
+ * the other one.  pool_lock guards the job and the worker bookkeeping.
+ *
+ * A batch is cut into grains, and each participant (the calling thread
+ * is participant 0, worker k is participant k) starts with a contiguous
+ * run of them in its deque.  Owners take grains from the front of their
+ * own deque; a participant whose deque is empty steals the back half of
+ * another's.  Element cost varies a lot (special values return at once,
+ * acosh does two csqrt and a clog), so static shares would leave threads
+ * idle.
+ */
+static pthread_mutex_t pool_submit = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+
+static int pool_wanted = 1;             /* CMath.threads, counting the caller */
+static int pool_size;                   /* worker threads running */
+static pthread_t *pool_workers;
+static int pool_stop;
+static unsigned long pool_generation;   /* bumped for every batch */
+static unsigned long pool_start_generation;
+static int pool_pending;                /* workers still busy with the batch */
+
+static struct {
+  cmath_task *fn;
+  void *arg;
+  mrb_int n;
+  mrb_int grain;
+  int parts;            /* participants in this batch */
+} pool_job;
+
+/* Grains [lo, hi) not yet taken; one per participant, on its own cache line */
+struct pool_deque {
+  pthread_mutex_t lock;
+  mrb_int lo, hi;
+} __attribute__((aligned(64)));
+
+static struct pool_deque *pool_deques;
+
+static mrb_int
+pool_pop(struct pool_deque *d)
+{
+  mrb_int g = -1;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->lo < d->hi) {
+    g = d->lo++;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return g;
+}
+
+/* Move the back half of some other deque into self's; return one grain of it */
+static mrb_int
+pool_steal(int self)
+{
+  int i;
+
+  for (i = 1; i < pool_job.parts; i++) {
+    struct pool_deque *victim = &pool_deques[(self + i) % pool_job.parts];
+    mrb_int lo, hi;
+
+    pthread_mutex_lock(&victim->lock);
+    hi = victim->hi;
+    lo = hi - (hi - victim->lo + 1) / 2;
+    victim->hi = lo;
+    pthread_mutex_unlock(&victim->lock);
+    if (lo < hi) {
+      struct pool_deque *d = &pool_deques[self];
+
+      pthread_mutex_lock(&d->lock);
+      d->lo = lo + 1;
+      d->hi = hi;
+      pthread_mutex_unlock(&d->lock);
+      return lo;
+    }
+  }
+  return -1;
+}
+
+static void
+pool_work(int self)
+{
+  mrb_int g;
+
+  if (self >= pool_job.parts) return;
+  while ((g = pool_pop(&pool_deques[self])) >= 0 || (g = pool_steal(self)) >= 0) {
+    mrb_int begin = g * pool_job.grain;
+    mrb_int end = begin + pool_job.grain;
+
+    if (end > pool_job.n) end = pool_job.n;
+    pool_job.fn(pool_job.arg, begin, end);
+  }
+}
+
+static void*
+pool_worker(void *p)
+{
+  int part = (int)(size_t)p;
+  unsigned long seen = pool_start_generation;
+
+  pthread_mutex_lock(&pool_lock);
+  for (;;) {
+    while (!pool_stop && pool_generation == seen) {
+      pthread_cond_wait(&pool_wake, &pool_lock);
+    }
+    if (pool_stop) break;
+    seen = pool_generation;
+    pthread_mutex_unlock(&pool_lock);
+    pool_work(part);
+    pthread_mutex_lock(&pool_lock);
+    if (--pool_pending == 0) {
+      pthread_cond_signal(&pool_done);
+    }
+  }
+  pthread_mutex_unlock(&pool_lock);
+  return NULL;
+}
+
+/* Called with pool_submit held: bring the pool to pool_wanted - 1 workers */
+static void
+pool_resize(void)
+{
+  int want = __atomic_load_n(&pool_wanted, __ATOMIC_RELAXED) - 1;
+  int i;
+
+  if (pool_size > 0) {
+    pthread_mutex_lock(&pool_lock);
+    pool_stop = 1;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    for (i = 0; i < pool_size; i++) {
+      pthread_join(pool_workers[i], NULL);
+    }
+    for (i = 0; i <= pool_size; i++) {
+      pthread_mutex_destroy(&pool_deques[i].lock);
+    }
+    free(pool_workers);
+    free(pool_deques);
+    pool_workers = NULL;
+    pool_deques = NULL;
+    pool_size = 0;
+    pool_stop = 0;
+  }
+  if (want <= 0) return;
+
+  /* Workers run outside any mrb_state, so plain malloc */
+  pool_workers = (pthread_t*)malloc(want * sizeof(pthread_t));
+  if (posix_memalign((void**)&pool_deques, sizeof(struct pool_deque),
+                     (want + 1) * sizeof(struct pool_deque)) != 0) {
+    pool_deques = NULL;
+  }
+  if (pool_workers == NULL || pool_deques == NULL) {
+    free(pool_workers);
+    free(pool_deques);
+    pool_workers = NULL;
+    pool_deques = NULL;
+    return;
+  }
+  for (i = 0; i <= want; i++) {
+    pthread_mutex_init(&pool_deques[i].lock, NULL);
+  }
+  pool_start_generation = pool_generation;
+  for (i = 0; i < want; i++) {
+    if (pthread_create(&pool_workers[i], NULL, pool_worker, (void*)(size_t)(i + 1)) != 0) {
+      break;
+    }
+  }
+  /* If some threads could not start, run with those that did */
+  pool_size = i;
+  for (i = pool_size + 1; i <= want; i++) {
+    pthread_mutex_destroy(&pool_deques[i].lock);
+  }
+}
+
+void
+cmath_parallel_for(mrb_int n, cmath_task *fn, void *arg)
+{
+  mrb_int parts, grains, i;
+
+  if (n < CMATH_PARALLEL_THRESHOLD || __atomic_load_n(&pool_wanted, __ATOMIC_RELAXED) <= 1) {
+    fn(arg, 0, n);
+    return;
+  }
+
+  if (pthread_mutex_trylock(&pool_submit) != 0) {
+    fn(arg, 0, n);
+    return;
+  }
+  if (pool_size != __atomic_load_n(&pool_wanted, __ATOMIC_RELAXED) - 1) {
+    pool_resize();
+  }
+  parts = n / CMATH_PARALLEL_MIN_CHUNK;
+  if (parts > pool_size + 1) parts = pool_size + 1;
+  if (parts <= 1) {
+    pthread_mutex_unlock(&pool_submit);
+    fn(arg, 0, n);
+    return;
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  pool_job.fn = fn;
+  pool_job.arg = arg;
+  pool_job.n = n;
+  pool_job.parts = (int)parts;
+  /* About eight grains per participant leaves room to rebalance */
+  pool_job.grain = n / (parts * 8);
+  if (pool_job.grain < CMATH_PARALLEL_GRAIN) pool_job.grain = CMATH_PARALLEL_GRAIN;
+  /* Keep vector kernels on the same lanes as a serial run, so results
+     do not depend on the thread count */
+  pool_job.grain = (pool_job.grain + 7) & ~(mrb_int)7;
+  grains = (n + pool_job.grain - 1) / pool_job.grain;
+  for (i = 0; i < parts; i++) {
+    /* No other participant is running, but the lock orders the stores */
+    pthread_mutex_lock(&pool_deques[i].lock);
+    pool_deques[i].lo = grains * i / parts;
+    pool_deques[i].hi = grains * (i + 1) / parts;
+    pthread_mutex_unlock(&pool_deques[i].lock);
+  }
+  pool_pending = pool_size;
+  pool_generation++;
+  pthread_cond_broadcast(&pool_wake);
+  pthread_mutex_unlock(&pool_lock);
+
+  pool_work(0);
+
+  pthread_mutex_lock(&pool_lock);
+  while (pool_pending > 0) {
+    pthread_cond_wait(&pool_done, &pool_lock);
+  }
+  pthread_mutex_unlock(&pool_lock);
+  pthread_mutex_unlock(&pool_submit);
+}
+
+static int
+pool_threads(void)
+{
+  return __atomic_load_n(&pool_wanted, __ATOMIC_RELAXED);
+}
+
+static void
+pool_set_threads(mrb_int n)
+{
+  if (n == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n = cpus > 0 ? (cpus < CMATH_MAX_THREADS ? cpus : CMATH_MAX_THREADS) : 1;
+  }
+  /* The pool is resized by the next batch, so a running one is not waited for */
+  __atomic_store_n(&pool_wanted, (int)n, __ATOMIC_RELAXED);
+}
+
+#else  /* CMATH_USE_PTHREAD */
+
+void
+cmath_parallel_for(mrb_int n, cmath_task *fn, void *arg)
+{
+  fn(arg, 0, n);
+}
+
+static int
+pool_threads(void)
+{
+  return 1;
+}
+
+static void
+pool_set_threads(mrb_int n)
+{
+}
+
+#endif  /* CMATH_USE_PTHREAD */
+
+/* threads: number of threads used for large Buffer batches */
+static mrb_value
+cmath_threads(mrb_state *mrb, mrb_value self)
+{
+  return mrb_int_value(mrb, pool_threads());
+}
+
+/*
+ * threads = n: use n threads, including the calling one, for large
+ * Buffer batches; 0 picks the number of online processors.  Without
+ * thread support the setting is ignored and batches run serially.
+ */
+static mrb_value
+cmath_set_threads(mrb_state *mrb, mrb_value self)
+{
+  mrb_int n;
+
+  mrb_get_args(mrb, "i", &n);
+  if (n < 0 || n > CMATH_MAX_THREADS) {
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "thread count %i out of range", n);
+  }
+  pool_set_threads(n);
+  return mrb_int_value(mrb, n);
+}
+
+void
+cmath_pool_init(mrb_state *mrb, struct RClass *cmath)
+{
+  mrb_define_module_function(mrb, cmath, "threads", cmath_threads, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, cmath, "threads=", cmath_set_threads, MRB_ARGS_REQ(1));
+}
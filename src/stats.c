@@ -0,0 +1,82 @@
+/*
+** stats.c - CMath.stats, optional call and branch counters
+**
+** See Copyright Notice in mruby.h
+*/
+
+#include <mruby.h>
+#include <mruby/hash.h>
+#include "cmath.h"
+
+#ifdef CMATH_ENABLE_STATS
+
+unsigned long cmath_stats[CMATH_STAT_COUNT];
+
+static const struct {
+  const char *func;
+  const char *counter;
+} cmath_stat_names[CMATH_STAT_COUNT] = {
+#define CMATH_STAT_NAME(f, c) { #f, #c },
+  CMATH_STATS_LIST(CMATH_STAT_NAME)
+#undef CMATH_STAT_NAME
+};
+
+/* stats: Hash of function => Hash of counter => count */
+static mrb_value
+cmath_stats_get(mrb_state *mrb, mrb_value self)
+{
+  mrb_value result = mrb_hash_new(mrb);
+  int ai = mrb_gc_arena_save(mrb);
+  int i;
+
+  for (i = 0; i < CMATH_STAT_COUNT; i++) {
+    mrb_value func = mrb_symbol_value(mrb_intern_cstr(mrb, cmath_stat_names[i].func));
+    mrb_value counter = mrb_symbol_value(mrb_intern_cstr(mrb, cmath_stat_names[i].counter));
+    mrb_value h = mrb_hash_get(mrb, result, func);
+    unsigned long n = __atomic_load_n(&cmath_stats[i], __ATOMIC_RELAXED);
+
+    if (mrb_nil_p(h)) {
+      h = mrb_hash_new(mrb);
+      mrb_hash_set(mrb, result, func, h);
+    }
+    mrb_hash_set(mrb, h, counter, mrb_int_value(mrb, (mrb_int)n));
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  return result;
+}
+
+/* reset_stats: set every counter to zero */
+static mrb_value
+cmath_stats_reset(mrb_state *mrb, mrb_value self)
+{
+  int i;
+
+  for (i = 0; i < CMATH_STAT_COUNT; i++) {
+    __atomic_store_n(&cmath_stats[i], 0, __ATOMIC_RELAXED);
+  }
+  return mrb_nil_value();
+}
+
+#else
+
+/* stats: nil; the gem was built without CMATH_ENABLE_STATS */
+static mrb_value
+cmath_stats_get(mrb_state *mrb, mrb_value self)
+{
+  return mrb_nil_value();
+}
+
+static mrb_value
+cmath_stats_reset(mrb_state *mrb, mrb_value self)
+{
+  return mrb_nil_value();
+}
+
+#endif
+
+void
+cmath_stats_init(mrb_state *mrb, struct RClass *cmath)
+{
+  mrb_define_module_function(mrb, cmath, "stats", cmath_stats_get, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, cmath, "reset_stats", cmath_stats_reset, MRB_ARGS_NONE());
+}
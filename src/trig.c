@@ -0,0 +1,227 @@
+/*
+** trig.c - sin and cos with the argument reduction done in the gem
+**
+** See Copyright Notice in mruby.h
+*/
+
+/*
+** cmath_trig_sincos reduces its argument modulo pi/2 once and evaluates
+** both the sine and the cosine from the reduced value, with the fdlibm
+** kernels.  Arguments up to 2^19*pi/2 are reduced with a three-part
+** Cody-Waite constant, the same steps as the vector kernels take, so
+** both paths agree; larger ones, and the rare ones that land too close
+** to a multiple of pi/2 for that, use a Payne-Hanek reduction against a
+** table of the bits of 2/pi.  libm sin and cos go through a much slower
+** path of their own for large arguments.
+**
+** Everything is computed in double, also for MRB_USE_FLOAT32 builds.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <mruby.h>
+#include "cmath.h"
+#include "two_over_pi.h"
+
+/* Largest |y| reduced with the Cody-Waite constant */
+#define CMATH_MEDIUM_MAX 0x1.921fb54442d18p19
+
+/* Words of 2/pi multiplied by the significand in the Payne-Hanek reduction */
+#define CMATH_PIO2_WINDOW 8
+
+/* Exact product a*b = *p + *e, without relying on a fused multiply-add */
+static void
+cmath_two_prod(double a, double b, double *p, double *e)
+{
+  static const double split = 134217729.0;     /* 2^27 + 1 */
+  double t, ah, al, bh, bl;
+
+  *p = a*b;
+  t = split*a;
+  ah = t - (t - a);
+  al = a - ah;
+  t = split*b;
+  bh = t - (t - b);
+  bl = b - bh;
+  *e = ((ah*bh - *p) + ah*bl + al*bh) + al*bl;
+}
+
+/* Bits [b, b+32) of the little-endian number p[0..n) */
+static uint32_t
+cmath_bits32(const uint32_t *p, int n, int b)
+{
+  int i = b / 32;
+  int sh = b % 32;
+  uint32_t lo = i < n ? p[i] : 0;
+  uint32_t hi = i + 1 < n ? p[i + 1] : 0;
+
+  return sh == 0 ? lo : (lo >> sh) | (hi << (32 - sh));
+}
+
+/*
+ * Payne-Hanek: y = n*pi/2 + (*y0 + *y1) for finite y > 0; returns n
+ * mod 4.  Only the window of 2/pi that reaches the last two bits of the
+ * integer part and the first 190 or so of the fraction is multiplied
+ * in; the bits above it contribute multiples of 4.
+ */
+static int
+cmath_rem_pio2_large(double y, double *y0, double *y1)
+{
+  static const double pio2_hi = 0x1.921fb54442d18p0;
+  static const double pio2_lo = 0x1.1a62633145c07p-54;
+  uint32_t w[CMATH_PIO2_WINDOW], p[CMATH_PIO2_WINDOW + 2], f[6];
+  uint64_t bits, mant, t;
+  int e, k0, point, i, j, z, n, neg;
+  double scale, hi, lo, ph, pe;
+
+  /* y = mant * 2^e, mant a 53-bit integer; y is normal here */
+  memcpy(&bits, &y, sizeof(y));
+  mant = (bits & 0xfffffffffffffULL) | 0x10000000000000ULL;
+  e = (int)(bits >> 52) - 1075;
+  /* Words before k0 give terms mant*w*2^(e-32k-32) that are multiples of 4 */
+  k0 = e < 34 ? 0 : (e - 34) / 32 + 1;
+  for (i = 0; i < CMATH_PIO2_WINDOW; i++) {
+    w[i] = cmath_two_over_pi[k0 + CMATH_PIO2_WINDOW - 1 - i];
+  }
+
+  /* p = mant * w, little-endian words */
+  for (i = 0; i < CMATH_PIO2_WINDOW + 2; i++) {
+    p[i] = 0;
+  }
+  for (j = 0; j < 2; j++) {
+    uint32_t m = (uint32_t)(mant >> (32*j));
+
+    t = 0;
+    for (i = 0; i < CMATH_PIO2_WINDOW; i++) {
+      t += (uint64_t)m*w[i] + p[i + j];
+      p[i + j] = (uint32_t)t;
+      t >>= 32;
+    }
+    p[CMATH_PIO2_WINDOW + j] = (uint32_t)t;
+  }
+
+  /* y*2/pi = p * 2^-point: quadrant above bit point, fraction below */
+  point = 32*(k0 + CMATH_PIO2_WINDOW) - e;
+  n = (int)(cmath_bits32(p, CMATH_PIO2_WINDOW + 2, point) & 3);
+  for (i = 0; i < 6; i++) {
+    f[i] = cmath_bits32(p, CMATH_PIO2_WINDOW + 2, point - 32*(i + 1));
+  }
+  /* Round to the nearest quadrant: a fraction over 1/2 becomes 1 - fraction */
+  neg = (f[0] & 0x80000000U) != 0;
+  if (neg) {
+    n = (n + 1) & 3;
+    t = 1;
+    for (i = 5; i >= 0; i--) {
+      t += (uint32_t)~f[i];
+      f[i] = (uint32_t)t;
+      t >>= 32;
+    }
+  }
+
+  /* The fraction as hi + lo, from the first nonzero word on */
+  for (z = 0; z < 3 && f[z] == 0; z++)
+    ;
+  bits = (uint64_t)(1023 - 64 - 32*z) << 52;
+  memcpy(&scale, &bits, sizeof(scale));         /* 2^(-64-32z) */
+  t = ((uint64_t)f[z] << 32) | f[z + 1];
+  hi = (double)(t >> 11) * 2048.0 * scale;
+  lo = ((double)(t & 0x7ff) + (double)(((uint64_t)f[z + 2] << 32) | f[z + 3]) * 0x1p-64) * scale;
+
+  /* times pi/2, in double-double */
+  cmath_two_prod(hi, pio2_hi, &ph, &pe);
+  pe += lo*pio2_hi + hi*pio2_lo;
+  *y0 = ph + pe;
+  *y1 = pe - (*y0 - ph);
+  if (neg) {
+    *y0 = -*y0;
+    *y1 = -*y1;
+  }
+  return n;
+}
+
+/* y = n*pi/2 + (*y0 + *y1) with |*y0 + *y1| <= pi/4; returns n mod 4 */
+static int
+cmath_rem_pio2(double y, double *y0, double *y1)
+{
+  static const double round_bias = 0x1.8p52;
+  static const double inv_pio2 = 6.36619772367581382433e-01;
+  static const double pio2_1 = 1.57079632673412561417e+00;
+  static const double pio2_2 = 6.07710050630396597660e-11;
+  static const double pio2_3 = 2.02226624871116645580e-21;
+  double ay = fabs(y);
+
+  if (ay <= CMATH_MEDIUM_MAX) {
+    double fn = y*inv_pio2 + round_bias;
+    int64_t bits;
+    int n;
+
+    /* The low bits of fn hold n; only n mod 4 is needed */
+    memcpy(&bits, &fn, sizeof(fn));
+    n = (int)(bits & 3);
+    fn -= round_bias;
+    /* pio2_1 has 33 bits, so fn*pio2_1 is exact */
+    double r = y - fn*pio2_1;
+    double w = fn*pio2_2;
+    double t = r;
+    r = t - w;
+    w = fn*pio2_3 - ((t - r) - w);
+    *y0 = r - w;
+    *y1 = (r - *y0) - w;
+    /* Too close to a multiple of pi/2 for three parts */
+    if (fabs(*y0) >= 0x1p-20 || fn == 0.0) {
+      CMATH_STAT(real_sincos, cody_waite);
+      return n;
+    }
+  }
+
+  CMATH_STAT(real_sincos, payne_hanek);
+  if (y < 0) {
+    int n = cmath_rem_pio2_large(-y, y0, y1);
+    *y0 = -*y0;
+    *y1 = -*y1;
+    return -n & 3;
+  }
+  return cmath_rem_pio2_large(y, y0, y1);
+}
+
+void
+cmath_trig_sincos(double y, double *s, double *c)
+{
+  static const double S1 = -1.66666666666666324348e-01;
+  static const double S2 = 8.33333333332248946124e-03;
+  static const double S3 = -1.98412698298579493134e-04;
+  static const double S4 = 2.75573137070700676789e-06;
+  static const double S5 = -2.50507602534068634195e-08;
+  static const double S6 = 1.58969099521155010221e-10;
+  static const double C1 = 4.16666666666666019037e-02;
+  static const double C2 = -1.38888888888741095749e-03;
+  static const double C3 = 2.48015872894767294178e-05;
+  static const double C4 = -2.75573143513906633035e-07;
+  static const double C5 = 2.08757232129817482790e-09;
+  static const double C6 = -1.13596475577881948265e-11;
+  double y0, y1, z, v, rs, sk, rc, hz, wc, ck;
+  int n;
+
+  if (!isfinite(y)) {
+    *s = *c = y - y;
+    return;
+  }
+  n = cmath_rem_pio2(y, &y0, &y1);
+
+  /* fdlibm __kernel_sin and __kernel_cos, with the tail y1 */
+  z = y0*y0;
+  v = z*y0;
+  rs = S2 + z*(S3 + z*(S4 + z*(S5 + z*S6)));
+  sk = y0 - ((z*(0.5*y1 - v*rs) - y1) - v*S1);
+  rc = z*(C1 + z*(C2 + z*(C3 + z*(C4 + z*(C5 + z*C6)))));
+  hz = 0.5*z;
+  wc = 1.0 - hz;
+  ck = wc + (((1.0 - wc) - hz) + (z*rc - y0*y1));
+
+  switch (n) {
+  case 0: *s = +sk; *c = +ck; break;
+  case 1: *s = +ck; *c = -sk; break;
+  case 2: *s = -sk; *c = -ck; break;
+  default: *s = -ck; *c = +sk; break;
+  }
+}
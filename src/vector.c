@@ -0,0 +1,173 @@
+/*
+** vector.c - vectorized kernels over packed complex arrays
+**
+** See Copyright Notice in mruby.h
+*/
+
+/*
+** These kernels use GCC vector extensions.  exp, sin and cos are
+** evaluated with the fdlibm reductions and polynomials, VLEN lanes at a
+** time.  A lane whose argument is outside the range the polynomials
+** cover -- including every NaN and infinity -- is flagged and recomputed
+** with the scalar kernel, so the special-value handling of cmath.c
+** carries over unchanged.
+**
+** The kernels themselves are in vector_kernels.h, which is instantiated
+** here for the baseline instruction set (SSE2 on x86) and in
+** vector_avx2.c and vector_avx512.c for wider units.  The backend is
+** picked once, from the CPU features, when the gem is initialized; the
+** CMATH_BACKEND environment variable can force a supported one.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <mruby.h>
+#include <mruby/string.h>
+#include "cmath.h"
+
+#ifdef CMATH_VECTOR
+
+#ifdef CMATH_X86
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#define VLEN 2
+#define VSUFFIX sse2
+#define VBACKEND "sse2"
+#include "vector_kernels.h"
+#pragma GCC pop_options
+#else
+#define VLEN 2
+#define VSUFFIX generic
+#define VBACKEND "vector"
+#include "vector_kernels.h"
+#endif
+
+/* The scalar backend runs every element through the scalar kernel */
+static void
+cmath_vscalar(mrb_complex *dst, const mrb_complex *src, mrb_int n, cmath_cfunc *fallback)
+{
+  mrb_int i;
+
+  for (i = 0; i < n; i++) {
+    dst[i] = fallback(src[i]);
+  }
+}
+
+static void
+cmath_vscalar_pair(mrb_complex *dsta, mrb_complex *dstb, const mrb_complex *src, mrb_int n,
+                   cmath_pairfunc *fallback)
+{
+  mrb_int i;
+
+  for (i = 0; i < n; i++) {
+    fallback(src[i], &dsta[i], &dstb[i]);
+  }
+}
+
+static const struct cmath_backend cmath_backend_scalar = {
+  "scalar",
+  cmath_vscalar, cmath_vscalar, cmath_vscalar, cmath_vscalar, cmath_vscalar, cmath_vscalar,
+  cmath_vscalar_pair, cmath_vscalar_pair
+};
+
+static const struct {
+  const struct cmath_backend *backend;
+  const char *feature;          /* CPU feature it needs, or NULL */
+} cmath_backends[] = {
+  /* Best first */
+#ifdef CMATH_X86
+  { &cmath_backend_avx512, "avx512f" },
+  { &cmath_backend_avx2, "avx2" },
+  { &cmath_backend_sse2, "sse2" },
+#else
+  { &cmath_backend_generic, NULL },
+#endif
+  { &cmath_backend_scalar, NULL },
+};
+
+static const struct cmath_backend *cmath_backend = &cmath_backend_scalar;
+static int cmath_backend_chosen;
+
+static int
+cmath_backend_supported(const char *feature)
+{
+  if (feature == NULL) return 1;
+#ifdef CMATH_X86
+  __builtin_cpu_init();
+  if (strcmp(feature, "avx512f") == 0) return __builtin_cpu_supports("avx512f");
+  if (strcmp(feature, "avx2") == 0) return __builtin_cpu_supports("avx2");
+  if (strcmp(feature, "sse2") == 0) return __builtin_cpu_supports("sse2");
+#endif
+  return 0;
+}
+
+/* The backend CMATH_BACKEND names if the CPU supports it, else the best supported */
+static void
+cmath_backend_choose(void)
+{
+  const char *force = getenv("CMATH_BACKEND");
+  size_t i;
+
+  for (i = 0; force && i < sizeof(cmath_backends)/sizeof(cmath_backends[0]); i++) {
+    if (strcmp(force, cmath_backends[i].backend->name) == 0 &&
+        cmath_backend_supported(cmath_backends[i].feature)) {
+      cmath_backend = cmath_backends[i].backend;
+      return;
+    }
+  }
+  for (i = 0; i < sizeof(cmath_backends)/sizeof(cmath_backends[0]); i++) {
+    if (cmath_backend_supported(cmath_backends[i].feature)) {
+      cmath_backend = cmath_backends[i].backend;
+      return;
+    }
+  }
+}
+
+#define DEF_CMATH_VDISPATCH(name) \
+void \
+cmath_v ## name(mrb_complex *dst, const mrb_complex *src, mrb_int n, cmath_cfunc *fallback)\
+{\
+  cmath_backend->name(dst, src, n, fallback);\
+}
+
+#define DEF_CMATH_VPAIRDISPATCH(name) \
+void \
+cmath_v ## name(mrb_complex *dsta, mrb_complex *dstb, const mrb_complex *src, mrb_int n, cmath_pairfunc *fallback)\
+{\
+  cmath_backend->name(dsta, dstb, src, n, fallback);\
+}
+
+DEF_CMATH_VDISPATCH(exp)
+DEF_CMATH_VDISPATCH(sin)
+DEF_CMATH_VDISPATCH(cos)
+DEF_CMATH_VDISPATCH(sinh)
+DEF_CMATH_VDISPATCH(cosh)
+DEF_CMATH_VDISPATCH(cis)
+DEF_CMATH_VPAIRDISPATCH(sincos)
+DEF_CMATH_VPAIRDISPATCH(sinhcosh)
+
+#endif  /* CMATH_VECTOR */
+
+/* backend: the kernels used for Buffer batches, such as "scalar" or "avx2" */
+static mrb_value
+cmath_backend_get(mrb_state *mrb, mrb_value self)
+{
+#ifdef CMATH_VECTOR
+  return mrb_str_new_cstr(mrb, cmath_backend->name);
+#else
+  return mrb_str_new_lit(mrb, "scalar");
+#endif
+}
+
+void
+cmath_backend_init(mrb_state *mrb, struct RClass *cmath)
+{
+#ifdef CMATH_VECTOR
+  /* Process-wide; every mrb_state would choose the same */
+  if (!cmath_backend_chosen) {
+    cmath_backend_choose();
+    cmath_backend_chosen = 1;
+  }
+#endif
+  mrb_define_module_function(mrb, cmath, "backend", cmath_backend_get, MRB_ARGS_NONE());
+}
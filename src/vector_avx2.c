@@ -0,0 +1,19 @@
+/*
+** vector_avx2.c - vector kernels built for AVX2
+**
+** See Copyright Notice in mruby.h
+*/
+
+#include "cmath.h"
+
+#if defined(CMATH_VECTOR) && defined(CMATH_X86)
+
+/* Only these functions use AVX2; vector.c calls them if the CPU has it */
+#pragma GCC target("avx2")
+
+#define VLEN 4
+#define VSUFFIX avx2
+#define VBACKEND "avx2"
+#include "vector_kernels.h"
+
+#endif
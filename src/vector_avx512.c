@@ -0,0 +1,21 @@
+/*
+** vector_avx512.c - vector kernels built for AVX512
+**
+** See Copyright Notice in mruby.h
+*/
+
+#include "cmath.h"
+
+#if defined(CMATH_VECTOR) && defined(CMATH_X86)
+
+/* Only these functions use AVX512; vector.c calls them if the CPU has it */
+#pragma GCC target("avx512f")
+/* AVX-512F brings FMA; keep a*b+c unfused, as in the other backends */
+#pragma GCC optimize("fp-contract=off")
+
+#define VLEN 8
+#define VSUFFIX avx512
+#define VBACKEND "avx512"
+#include "vector_kernels.h"
+
+#endif
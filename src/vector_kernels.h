@@ -0,0 +1,357 @@
+/*
+** vector_kernels.h - vector kernel template, one instance per instruction set
+**
+** See Copyright Notice in mruby.h
+*/
+
+/*
+** Included once by vector.c and by each vector_<isa>.c.  The includer
+** defines VLEN, the lanes per vector, VSUFFIX, appended to every kernel
+** name, and VBACKEND, the name reported by CMath.backend; it selects the
+** instruction set with #pragma GCC target before including this file.
+** The template defines the kernels and the backend table
+** cmath_backend_<VSUFFIX> that points at them.
+**
+** Every instance performs the same IEEE operations lane by lane, so the
+** backends give identical results; only the width differs.
+*/
+
+#include <stdint.h>
+
+#define VCAT2(a, b) a ## _ ## b
+#define VCAT(a, b) VCAT2(a, b)
+#define VNAME(name) VCAT(cmath_v ## name, VSUFFIX)
+
+typedef double vdouble __attribute__((vector_size(VLEN*8)));
+typedef int64_t vlong __attribute__((vector_size(VLEN*8)));
+
+#define SIGN_BIT   ((int64_t)0x8000000000000000ULL)
+/* x + ROUND_BIAS - ROUND_BIAS rounds x to an integer, left in the low bits */
+#define ROUND_BIAS 0x1.8p52
+#define ROUND_BIAS_BITS ((int64_t)0x4338000000000000ULL)
+
+/* Largest |x| for which exp(x) and exp(-x) are both normal */
+#define EXP_MAX    708.0
+/* Largest |y| reduced modulo pi/2 in three parts without losing accuracy */
+#define TRIG_MAX   0x1p19
+
+static inline vdouble
+vabs(vdouble x)
+{
+  return (vdouble)((vlong)x & ~SIGN_BIT);
+}
+
+static inline vdouble
+vcopysign(vdouble x, vdouble s)
+{
+  return (vdouble)(((vlong)x & ~SIGN_BIT) | ((vlong)s & SIGN_BIT));
+}
+
+static inline vdouble
+vselect(vlong m, vdouble a, vdouble b)
+{
+  return (vdouble)(((vlong)a & m) | ((vlong)b & ~m));
+}
+
+static inline int
+vany(vlong m)
+{
+  int j;
+
+  for (j = 0; j < VLEN; j++) {
+    if (m[j]) return 1;
+  }
+  return 0;
+}
+
+/* exp(x) for |x| <= EXP_MAX */
+static inline vdouble
+vexp(vdouble x)
+{
+  static const double ln2_hi = 6.93147180369123816490e-01;
+  static const double ln2_lo = 1.90821492927058770002e-10;
+  static const double inv_ln2 = 1.44269504088896338700e+00;
+  static const double P1 = 1.66666666666666019037e-01;
+  static const double P2 = -2.77777777770155933842e-03;
+  static const double P3 = 6.61375632143793436117e-05;
+  static const double P4 = -1.65339022054652515390e-06;
+  static const double P5 = 4.13813679705723846039e-08;
+
+  vdouble kd = x*inv_ln2 + ROUND_BIAS;
+  vlong k = (vlong)kd - ROUND_BIAS_BITS;
+  kd -= ROUND_BIAS;
+
+  vdouble hi = x - kd*ln2_hi;
+  vdouble lo = kd*ln2_lo;
+  vdouble r = hi - lo;
+  vdouble t = r*r;
+  vdouble c = r - t*(P1 + t*(P2 + t*(P3 + t*(P4 + t*P5))));
+  vdouble y = 1.0 - ((lo - (r*c)/(2.0 - c)) - hi);
+
+  return y * (vdouble)((k + 1023) << 52);
+}
+
+/* sinh(x) and cosh(x) for |x| <= EXP_MAX */
+static inline void
+vsinhcosh(vdouble x, vdouble *s, vdouble *c)
+{
+  vdouble ax = vabs(x);
+  vdouble e = vexp(ax);
+  vdouble ie = 1.0/e;
+  vdouble x2 = x*x;
+  /* Taylor series; exp(x)-exp(-x) cancels for small x */
+  vdouble sp = x + x*x2*(0.16666666666666666 + x2*(0.008333333333333333
+             + x2*(0.0001984126984126984 + x2*(2.7557319223985893e-06
+             + x2*(2.505210838544172e-08 + x2*(1.6059043836821613e-10
+             + x2*(7.647163731819816e-13 + x2*2.8114572543455206e-15)))))));
+
+  *c = 0.5*e + 0.5*ie;
+  *s = vselect(ax < 1.0, sp, vcopysign(0.5*e - 0.5*ie, x));
+}
+
+/* sin(y) and cos(y) for |y| <= TRIG_MAX; lanes losing accuracy are flagged in *bad */
+static inline void
+vsincos(vdouble y, vdouble *s, vdouble *c, vlong *bad)
+{
+  static const double inv_pio2 = 6.36619772367581382433e-01;
+  static const double pio2_1 = 1.57079632673412561417e+00;
+  static const double pio2_2 = 6.07710050630396597660e-11;
+  static const double pio2_3 = 2.02226624871116645580e-21;
+  static const double S1 = -1.66666666666666324348e-01;
+  static const double S2 = 8.33333333332248946124e-03;
+  static const double S3 = -1.98412698298579493134e-04;
+  static const double S4 = 2.75573137070700676789e-06;
+  static const double S5 = -2.50507602534068634195e-08;
+  static const double S6 = 1.58969099521155010221e-10;
+  static const double C1 = 4.16666666666666019037e-02;
+  static const double C2 = -1.38888888888741095749e-03;
+  static const double C3 = 2.48015872894767294178e-05;
+  static const double C4 = -2.75573143513906633035e-07;
+  static const double C5 = 2.08757232129817482790e-09;
+  static const double C6 = -1.13596475577881948265e-11;
+
+  /* y = n*pi/2 + (y0 + y1), |y0 + y1| <= pi/4 */
+  vdouble fn = y*inv_pio2 + ROUND_BIAS;
+  vlong n = (vlong)fn;
+  fn -= ROUND_BIAS;
+
+  vdouble r = y - fn*pio2_1;
+  vdouble w = fn*pio2_2;
+  vdouble t = r;
+  r = t - w;
+  w = fn*pio2_3 - ((t - r) - w);
+  vdouble y0 = r - w;
+  vdouble y1 = (r - y0) - w;
+  /* Too close to a multiple of pi/2 for a three-part reduction */
+  *bad |= (vabs(y0) < 0x1p-20) & (fn != 0.0);
+
+  vdouble z = y0*y0;
+  vdouble v = z*y0;
+  vdouble rs = S2 + z*(S3 + z*(S4 + z*(S5 + z*S6)));
+  vdouble sk = y0 - ((z*(0.5*y1 - v*rs) - y1) - v*S1);
+  vdouble rc = z*(C1 + z*(C2 + z*(C3 + z*(C4 + z*(C5 + z*C6)))));
+  vdouble hz = 0.5*z;
+  vdouble wc = 1.0 - hz;
+  vdouble ck = wc + (((1.0 - wc) - hz) + (z*rc - y0*y1));
+
+  vlong swap = (n & 1) != 0;
+  vdouble ss = vselect(swap, ck, sk);
+  vdouble cc = vselect(swap, sk, ck);
+  *s = (vdouble)((vlong)ss ^ ((n << 62) & SIGN_BIT));
+  *c = (vdouble)((vlong)cc ^ (((n + 1) << 62) & SIGN_BIT));
+}
+
+/* The body of each kernel sees x and y with out-of-range lanes zeroed */
+
+static inline vlong
+vkernel_exp(vdouble x, vdouble y, vdouble *u, vdouble *v)
+{
+  vlong bad = ~((vabs(x) <= EXP_MAX) & (vabs(y) <= TRIG_MAX));
+  vdouble e, sy, cy;
+
+  x = vselect(bad, (vdouble){0}, x);
+  y = vselect(bad, (vdouble){0}, y);
+  e = vexp(x);
+  vsincos(y, &sy, &cy, &bad);
+  *u = e*cy;
+  *v = e*sy;
+  return bad;
+}
+
+static inline vlong
+vkernel_sinh(vdouble x, vdouble y, vdouble *u, vdouble *v)
+{
+  vlong bad = ~((vabs(x) <= EXP_MAX) & (vabs(y) <= TRIG_MAX));
+  vdouble sx, cx, sy, cy;
+
+  x = vselect(bad, (vdouble){0}, x);
+  y = vselect(bad, (vdouble){0}, y);
+  vsinhcosh(x, &sx, &cx);
+  vsincos(y, &sy, &cy, &bad);
+  *u = sx*cy;
+  *v = cx*sy;
+  return bad;
+}
+
+static inline vlong
+vkernel_cosh(vdouble x, vdouble y, vdouble *u, vdouble *v)
+{
+  vlong bad = ~((vabs(x) <= EXP_MAX) & (vabs(y) <= TRIG_MAX));
+  vdouble sx, cx, sy, cy;
+
+  x = vselect(bad, (vdouble){0}, x);
+  y = vselect(bad, (vdouble){0}, y);
+  vsinhcosh(x, &sx, &cx);
+  vsincos(y, &sy, &cy, &bad);
+  *u = cx*cy;
+  *v = sx*sy;
+  return bad;
+}
+
+static inline vlong
+vkernel_sin(vdouble x, vdouble y, vdouble *u, vdouble *v)
+{
+  vlong bad = ~((vabs(x) <= TRIG_MAX) & (vabs(y) <= EXP_MAX));
+  vdouble sx, cx, sy, cy;
+
+  x = vselect(bad, (vdouble){0}, x);
+  y = vselect(bad, (vdouble){0}, y);
+  vsincos(x, &sx, &cx, &bad);
+  vsinhcosh(y, &sy, &cy);
+  *u = sx*cy;
+  *v = cx*sy;
+  return bad;
+}
+
+static inline vlong
+vkernel_cos(vdouble x, vdouble y, vdouble *u, vdouble *v)
+{
+  vlong bad = ~((vabs(x) <= TRIG_MAX) & (vabs(y) <= EXP_MAX));
+  vdouble sx, cx, sy, cy;
+
+  x = vselect(bad, (vdouble){0}, x);
+  y = vselect(bad, (vdouble){0}, y);
+  vsincos(x, &sx, &cx, &bad);
+  vsinhcosh(y, &sy, &cy);
+  *u = cx*cy;
+  *v = -(sx*sy);
+  return bad;
+}
+
+#define DEF_CMATH_VKERNEL(name) \
+static void \
+VNAME(name)(mrb_complex *dst, const mrb_complex *src, mrb_int n, cmath_cfunc *fallback)\
+{\
+  mrb_int i, j, m;\
+  for (i = 0; i < n; i += VLEN) {\
+    vdouble x = {0}, y = {0}, u, v;\
+    vlong bad;\
+    /* A short last vector is padded with zeros, so every width \
+       computes each element the same way */\
+    m = n - i < VLEN ? n - i : VLEN;\
+    for (j = 0; j < m; j++) {\
+      x[j] = cmath_creal(src[i+j]);\
+      y[j] = cmath_cimag(src[i+j]);\
+    }\
+    bad = vkernel_ ## name(x, y, &u, &v);\
+    for (j = 0; j < m; j++) {\
+      dst[i+j] = bad[j] ? fallback(src[i+j]) : cmath_build_complex(u[j], v[j]);\
+    }\
+  }\
+}
+
+static inline vlong
+vkernel_cis(vdouble x, vdouble y, vdouble *u, vdouble *v)
+{
+  vlong bad = ~((vabs(x) <= TRIG_MAX) & (vabs(y) <= EXP_MAX));
+  vdouble sx, cx;
+
+  x = vselect(bad, (vdouble){0}, x);
+  y = vselect(bad, (vdouble){0}, y);
+  vsincos(x, &sx, &cx, &bad);
+  if (vany(y != 0.0)) {
+    /* exp(i*(x+iy)) = exp(-y)*(cos(x) + i*sin(x)) */
+    vdouble e = vexp(-y);
+    cx *= e;
+    sx *= e;
+  }
+  *u = cx;
+  *v = sx;
+  return bad;
+}
+
+/* Paired kernels: u, v is the first result and u2, v2 the second */
+
+static inline vlong
+vkernel_sinhcosh(vdouble x, vdouble y, vdouble *u, vdouble *v, vdouble *u2, vdouble *v2)
+{
+  vlong bad = ~((vabs(x) <= EXP_MAX) & (vabs(y) <= TRIG_MAX));
+  vdouble sx, cx, sy, cy;
+
+  x = vselect(bad, (vdouble){0}, x);
+  y = vselect(bad, (vdouble){0}, y);
+  vsinhcosh(x, &sx, &cx);
+  vsincos(y, &sy, &cy, &bad);
+  *u = sx*cy;
+  *v = cx*sy;
+  *u2 = cx*cy;
+  *v2 = sx*sy;
+  return bad;
+}
+
+static inline vlong
+vkernel_sincos(vdouble x, vdouble y, vdouble *u, vdouble *v, vdouble *u2, vdouble *v2)
+{
+  vlong bad = ~((vabs(x) <= TRIG_MAX) & (vabs(y) <= EXP_MAX));
+  vdouble sx, cx, sy, cy;
+
+  x = vselect(bad, (vdouble){0}, x);
+  y = vselect(bad, (vdouble){0}, y);
+  vsincos(x, &sx, &cx, &bad);
+  vsinhcosh(y, &sy, &cy);
+  *u = sx*cy;
+  *v = cx*sy;
+  *u2 = cx*cy;
+  *v2 = -(sx*sy);
+  return bad;
+}
+
+#define DEF_CMATH_VPAIRKERNEL(name) \
+static void \
+VNAME(name)(mrb_complex *dsta, mrb_complex *dstb, const mrb_complex *src, mrb_int n, cmath_pairfunc *fallback)\
+{\
+  mrb_int i, j, m;\
+  for (i = 0; i < n; i += VLEN) {\
+    vdouble x = {0}, y = {0}, u, v, u2, v2;\
+    vlong bad;\
+    m = n - i < VLEN ? n - i : VLEN;\
+    for (j = 0; j < m; j++) {\
+      x[j] = cmath_creal(src[i+j]);\
+      y[j] = cmath_cimag(src[i+j]);\
+    }\
+    bad = vkernel_ ## name(x, y, &u, &v, &u2, &v2);\
+    for (j = 0; j < m; j++) {\
+      if (bad[j]) {\
+        fallback(src[i+j], &dsta[i+j], &dstb[i+j]);\
+      } else {\
+        dsta[i+j] = cmath_build_complex(u[j], v[j]);\
+        dstb[i+j] = cmath_build_complex(u2[j], v2[j]);\
+      }\
+    }\
+  }\
+}
+
+DEF_CMATH_VKERNEL(exp)
+DEF_CMATH_VKERNEL(sin)
+DEF_CMATH_VKERNEL(cos)
+DEF_CMATH_VKERNEL(sinh)
+DEF_CMATH_VKERNEL(cosh)
+DEF_CMATH_VKERNEL(cis)
+DEF_CMATH_VPAIRKERNEL(sincos)
+DEF_CMATH_VPAIRKERNEL(sinhcosh)
+
+const struct cmath_backend VCAT(cmath_backend, VSUFFIX) = {
+  VBACKEND,
+  VNAME(exp), VNAME(sin), VNAME(cos), VNAME(sinh), VNAME(cosh), VNAME(cis),
+  VNAME(sincos), VNAME(sinhcosh)
+};
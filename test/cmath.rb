@@ -16,13 +16,30 @@ end
 
 assert('CMath.log') do
   assert_float(0, CMath.log(1))
-  assert_float(3.0, CMath.log(8,2))
+  assert_equal(3.0, CMath.log(8,2))
+  assert_equal(1.0, CMath.log(10,10))
   assert_complex((1.092840647090816-0.42078724841586035i), CMath.log(-8,-2))
 end
 
 assert('CMath.sqrt') do
   assert_complex(Complex(0,2), CMath.sqrt(-4.0))
   assert_complex(Complex(0,3), CMath.sqrt(-9.0))
+  assert_complex(2+1i, CMath.sqrt(3+4i))
+  assert_complex(1+2i, CMath.sqrt(-3+4i))
+  assert_complex(1-2i, CMath.sqrt(-3-4i))
+  assert_complex(Complex(0.7071067811865476, 0.7071067811865475), CMath.sqrt(1i))
+end
+
+assert('CMath.sqrt accuracy at extreme magnitudes') do
+  def assert_rel(c1, c2)
+    assert_float(1.0, c2.real / c1.real)
+    assert_float(1.0, c2.imaginary / c1.imaginary)
+  end
+  assert_rel(Complex(1.345607733249115e+154, 5.5736897274590134e+153), CMath.sqrt(Complex(1.5e308, 1.5e308)))
+  assert_rel(Complex(6.9724755013252e+153, -1.2190792206275197e+154), CMath.sqrt(Complex(-1e308, -1.7e308)))
+  assert_rel(Complex(1.738003741013687e-160, -1.4384158727406445e-161), CMath.sqrt(Complex(3e-320, -5e-321)))
+  assert_rel(Complex(4.999999999999985e-161, 1e-150), CMath.sqrt(Complex(-1e-300, 1e-310)))
+  assert_rel(Complex(100000.0, 5e-16), CMath.sqrt(Complex(1e10, 1e-10)))
 end
 
 assert('CMath trigonometric_functions') do
@@ -39,3 +56,422 @@ assert('CMath trigonometric_functions') do
   assert_complex(1+1i, CMath.cosh(CMath.acosh(1+1i)))
   assert_complex(1+1i, CMath.tanh(CMath.atanh(1+1i)))
 end
+
+assert('CMath batch functions') do
+  r = CMath.exp_all([0, 1.0, 1+2i])
+  assert_equal(3, r.size)
+  assert_float(1.0, r[0])
+  assert_float(Math::E, r[1])
+  assert_complex(CMath.exp(1+2i), r[2])
+  r = CMath.sqrt_all([4, -4.0])
+  assert_float(2.0, r[0])
+  assert_complex(Complex(0,2), r[1])
+  assert_complex(CMath.atanh(1+1i), CMath.atanh_all([1+1i])[0])
+  assert_equal([], CMath.sin_all([]))
+  assert_raise(TypeError) { CMath.cos_all(["1"]) }
+end
+
+assert('CMath::Buffer') do
+  b = CMath::Buffer.new([1, 2.5, 3-4i])
+  assert_equal(3, b.length)
+  assert_complex(Complex(2.5,0), b[1])
+  assert_complex(Complex(3,-4), b[-1])
+  assert_nil(b[3])
+  b[0] = 1i
+  assert_complex(1i, b.to_a[0])
+  assert_raise(IndexError) { b[3] = 0 }
+  assert_equal(0, CMath::Buffer.new(0).size)
+  assert_complex(0i, CMath::Buffer.new(2)[1])
+  c = CMath::Buffer.new(b.dump)
+  assert_equal(3, c.size)
+  assert_complex(Complex(3,-4), c[2])
+  d = b.dup
+  d[1] = 0
+  assert_complex(Complex(2.5,0), b[1])
+end
+
+assert('CMath batch functions on CMath::Buffer') do
+  z = [0i, 1+2i, -3.5+0.25i, 0.5-4i, 5+1i, 1e5-0.5i, -2e5+0.5i]
+  b = CMath::Buffer.new(z)
+  %i(exp sin cos sinh cosh tan sqrt log).each do |f|
+    r = CMath.__send__(:"#{f}_all", b)
+    assert_kind_of(CMath::Buffer, r)
+    assert_equal(z.size, r.size)
+    z.each_with_index do |v, i|
+      # exp, sinh and cosh overflow on these; the rest reduce them as arguments
+      next if v.real.abs > 30 && %i(exp sinh cosh).include?(f)
+      assert_complex(CMath.__send__(f, v), r[i])
+    end
+  end
+  r = CMath.exp_all(CMath::Buffer.new([Complex(Float::NAN, 0)]))
+  assert_true(r[0].real.nan?)
+end
+
+assert('CMath.sincos and CMath.sinhcosh') do
+  s, c = CMath.sincos(1+2i)
+  assert_complex(CMath.sin(1+2i), s)
+  assert_complex(CMath.cos(1+2i), c)
+  s, c = CMath.sinhcosh(-0.5+3i)
+  assert_complex(CMath.sinh(-0.5+3i), s)
+  assert_complex(CMath.cosh(-0.5+3i), c)
+  s, c = CMath.sincos(2)
+  assert_float(Math.sin(2), s)
+  assert_float(Math.cos(2), c)
+  s, c = CMath.sinhcosh(0.25)
+  assert_float(Math.sinh(0.25), s)
+  assert_float(Math.cosh(0.25), c)
+
+  z = [0.5, 1+2i, -3-0.5i]
+  s, c = CMath.sincos_all(z)
+  z.each_with_index do |v, i|
+    assert_complex(CMath.sin(v) + 0i, s[i] + 0i)
+    assert_complex(CMath.cos(v) + 0i, c[i] + 0i)
+  end
+  s, c = CMath.sinhcosh_all(CMath::Buffer.new(z))
+  assert_kind_of(CMath::Buffer, s)
+  z.each_with_index do |v, i|
+    assert_complex(CMath.sinh(v + 0i), s[i])
+    assert_complex(CMath.cosh(v + 0i), c[i])
+  end
+end
+
+assert('CMath.cis') do
+  assert_complex(1+0i, CMath.cis(0))
+  assert_complex(Complex(Math.cos(0.75), Math.sin(0.75)), CMath.cis(0.75))
+  assert_complex(CMath.exp(1i * (2-0.5i)), CMath.cis(2-0.5i))
+  t = [0, 0.5, -3.25, 100.0]
+  r = CMath.cis_all(t)
+  t.each_with_index { |v, i| assert_complex(CMath.cis(v), r[i]) }
+  r = CMath.cis_all(CMath::Buffer.new(t))
+  t.each_with_index { |v, i| assert_complex(CMath.cis(v), r[i]) }
+end
+
+assert('CMath.stats') do
+  CMath.reset_stats
+  stats = CMath.stats
+  skip "built without CMATH_ENABLE_STATS" if stats.nil?
+  assert_equal 0, stats[:sqrt][:real]
+  CMath.sqrt(4)
+  CMath.sqrt(-4)
+  CMath.sqrt(3+4i)
+  CMath.exp_all([1, 1i])
+  stats = CMath.stats
+  assert_equal 1, stats[:sqrt][:real]
+  assert_equal 2, stats[:sqrt][:complex]
+  assert_equal 1, stats[:exp][:real]
+  assert_equal 1, stats[:exp][:complex]
+  CMath.reset_stats
+  assert_equal 0, CMath.stats[:sqrt][:complex]
+end
+
+assert('CMath.exp_into') do
+  buf = CMath::Buffer.new(3)
+  assert_same buf, CMath.exp_into(buf, 1, 1+2i)
+  assert_complex CMath.exp(1+2i), buf[1]
+  assert_complex 0i, buf[0]
+  CMath.sqrt_into(buf, -1, -4)
+  assert_complex Complex(0, 2), buf[2]
+  assert_raise(IndexError) { CMath.log_into(buf, 3, 1) }
+  assert_raise(TypeError) { CMath.log_into([0], 0, 1) }
+end
+
+assert('CMath::Buffer#exp!') do
+  z = [0, 1+2i, -3.5, Complex(0, 1e-3), 5+1i]
+  %w(exp log sqrt sin cos tan sinh cosh tanh asinh atanh cis).each do |f|
+    buf = CMath::Buffer.new(z)
+    assert_same buf, buf.__send__(:"#{f}!")
+    z.each_with_index do |v, i|
+      assert_complex CMath.__send__(f, v + 0i), buf[i]
+    end
+  end
+end
+
+assert('CMath.threads') do
+  saved = CMath.threads
+  begin
+    assert_raise(ArgumentError) { CMath.threads = -1 }
+    CMath.threads = 4
+    z = Array.new(10000) { |i| Complex(0.001 * i - 5, 0.0007 * i - 3) }
+    buf = CMath::Buffer.new(z)
+    par = CMath.asinh_all(buf)
+    s, c = CMath.sincos_all(buf)
+    CMath.threads = 1
+    assert_equal 1, CMath.threads
+    assert_equal CMath.asinh_all(buf).dump, par.dump
+    assert_equal CMath.sincos_all(buf)[1].dump, c.dump
+  ensure
+    CMath.threads = saved
+  end
+end
+
+assert('CMath threads with uneven element cost') do
+  saved = CMath.threads
+  begin
+    nan = Float::NAN
+    z = Array.new(20000) { |i| i % 16 < 12 ? Complex(nan, 1) : Complex(0.001 * i, -2.5) }
+    buf = CMath::Buffer.new(z)
+    CMath.threads = 1
+    serial = CMath.acosh_all(buf).dump
+    CMath.threads = 3
+    assert_equal serial, CMath.acosh_all(buf).dump
+    assert_equal serial, buf.dup.acosh!.dump
+  ensure
+    CMath.threads = saved
+  end
+end
+
+assert('CMath.async') do
+  buf = CMath::Buffer.new(Array.new(5000) { |i| Complex(0.001 * i, -1) })
+  job = CMath.async(:sqrt, buf)
+  assert_kind_of CMath::Job, job
+  out = job.wait
+  assert_true job.done?
+  assert_equal CMath.sqrt_all(buf).dump, out.dump
+  assert_same out, job.wait
+  buf[0] = 1
+  assert_complex 1+0i, buf[0]
+  assert_raise(ArgumentError) { CMath.async(:nosuch, buf) }
+  assert_raise(TypeError) { CMath.async(:exp, [1, 2]) }
+end
+
+assert('CMath batches while a job is running') do
+  saved = CMath.threads
+  begin
+    big = CMath::Buffer.new(Array.new(200000) { |i| Complex(0.0001 * i - 10, 1) })
+    buf = CMath::Buffer.new(Array.new(10000) { |i| Complex(0.001 * i - 5, 0.3) })
+    CMath.threads = 1
+    serial = CMath.asinh_all(buf).dump
+    ref = CMath.acosh_all(big).dump
+    CMath.threads = 2
+    job = CMath.async(:acosh, big)
+    assert_equal serial, CMath.asinh_all(buf).dump
+    CMath.threads = 3
+    assert_equal 3, CMath.threads
+    assert_equal ref, job.wait.dump
+    assert_equal serial, CMath.asinh_all(buf).dump
+  ensure
+    CMath.threads = saved
+  end
+end
+
+assert('CMath.backend') do
+  assert_include %w(scalar vector sse2 avx2 avx512), CMath.backend
+end
+
+assert('CMath batch with and without special values') do
+  z = Array.new(200) { |i| Complex(0.05 * i - 5, 1.5 - 0.02 * i) }
+  z[150] = Complex(Float::INFINITY, 1)
+  buf = CMath::Buffer.new(z)
+  %w(sqrt tan tanh asin acos atan asinh acosh atanh).each do |f|
+    out = CMath.__send__(:"#{f}_all", buf)
+    [0, 63, 64, 149].each do |i|
+      assert_complex CMath.__send__(f, z[i]), out[i]
+    end
+    assert_equal CMath.__send__(f, z[150]).to_s, out[150].to_s
+  end
+end
+
+assert('CMath large imaginary parts') do
+  [1.0e6, -3.0e9, 1.0e22, 6381956970095103.0 * 2.0**797].each do |y|
+    assert_complex Complex(Math.cos(y), Math.sin(y)), CMath.exp(Complex(0, y))
+    assert_complex Complex(Math.cos(y), 0), CMath.cosh(Complex(0, y))
+  end
+end
+
+assert('CMath.log with repeated bases') do
+  z = Complex(1.5, -0.5)
+  [2, 10, 0.5, 3, 7, 2, 10, -2, 2].each do |b|
+    l = CMath.log(b)
+    l = Complex(l, 0) unless l.is_a?(Complex)
+    assert_complex CMath.log(z) / l, CMath.log(z, b)
+  end
+  assert_float(2.0, CMath.log(100, 10))
+  assert_complex((1.092840647090816-0.42078724841586035i), CMath.log(-8,-2))
+end
+
+assert('CMath.log_all with a base') do
+  z = [8, -8, 1.5, Complex(1.5, -0.5)]
+  [2, -2, Complex(1, 1)].each do |b|
+    r = CMath.log_all(z, b)
+    buf = CMath.log_all(CMath::Buffer.new(z), b)
+    z.each_with_index do |x, i|
+      assert_complex CMath.log(x, b) + 0i, r[i] + 0i if b == 2
+      assert_complex r[i] + 0i, buf[i]
+    end
+  end
+  assert_kind_of Float, CMath.log_all([8], 2)[0]
+  [0.3, 10.0, 12345.0].each { |x| assert_equal CMath.log_all([x], 3)[0], CMath.log(x, 3) }
+  assert_equal 3.0, CMath.log_all([8], 2)[0]
+  assert_equal 1.0, CMath.log_all(CMath::Buffer.new([10]), 10)[0].real
+  assert_complex CMath.log(Complex(1.5, -0.5)) / CMath.log(Complex(1, 1)),
+                 CMath.log_all([Complex(1.5, -0.5)], Complex(1, 1))[0]
+  assert_equal CMath.log_all([2.5]), [CMath.log(2.5)]
+end
+
+assert('CMath::FFT') do
+  def dft(z)
+    n = z.size
+    Array.new(n) do |k|
+      s = 0i
+      z.each_with_index { |x, j| s += x * CMath.exp(Complex(0, -2 * Math::PI * (j * k % n) / n)) }
+      s
+    end
+  end
+  [1, 2, 8, 12, 30, 49, 11, 26].each do |n|
+    z = Array.new(n) { |i| Complex(Math.sin(i + 1), 0.5 - 0.1 * i) }
+    buf = CMath::Buffer.new(z)
+    assert_same buf, CMath::FFT.forward(buf)
+    dft(z).each_with_index { |x, k| assert_complex x, buf[k] }
+    CMath::FFT.inverse(buf)
+    z.each_with_index { |x, i| assert_complex x, buf[i] }
+  end
+  assert_raise(TypeError) { CMath::FFT.forward([1, 2]) }
+end
+
+assert('CMath::FFT.plan') do
+  plan = CMath::FFT.plan(12)
+  assert_equal 12, plan.size
+  z = Array.new(12) { |i| Complex(0.25 * i, 1 - 0.5 * i) }
+  a = CMath::FFT.forward(CMath::Buffer.new(z))
+  b = CMath::Buffer.new(z)
+  assert_same b, plan.forward(b)
+  assert_equal a.dump, b.dump
+  plan.inverse(b)
+  z.each_with_index { |x, i| assert_complex x, b[i] }
+  assert_raise(ArgumentError) { plan.forward(CMath::Buffer.new(8)) }
+  assert_raise(ArgumentError) { CMath::FFT.plan(0) }
+  assert_raise(ArgumentError) { CMath::FFT.plan(2**60) }
+  assert_raise(ArgumentError) { CMath::FFT.plan(2**59 + 1) }
+
+  w = CMath::FFT.export_wisdom
+  assert_true CMath::FFT.import_wisdom(w) >= 1
+  assert_equal a.dump, CMath::FFT.forward(CMath::Buffer.new(z)).dump
+  w.setbyte(-1, w.getbyte(-1) ^ 1)
+  assert_raise(RuntimeError) { CMath::FFT.import_wisdom(w) }
+  assert_raise(RuntimeError) { CMath::FFT.import_wisdom(w[0, 20]) }
+  assert_raise(RuntimeError) { CMath::FFT.import_wisdom("") }
+end
+
+assert('CMath::FFT.rfft and irfft') do
+  [1, 8, 12, 15, 20].each do |n|
+    x = Array.new(n) { |i| Math.cos(0.3 * i * i) }
+    full = CMath::FFT.forward(CMath::Buffer.new(x))
+    half = CMath::FFT.rfft(x)
+    assert_equal n / 2 + 1, half.size
+    half.size.times { |k| assert_complex full[k], half[k] }
+    y = CMath::FFT.irfft(half, n)
+    assert_equal n, y.size
+    x.each_with_index { |v, i| assert_float v, y[i] }
+  end
+  assert_equal 8, CMath::FFT.irfft(CMath::FFT.rfft([1, 2, 3, 4, 5, 6, 7, 8])).size
+  assert_raise(ArgumentError) { CMath::FFT.irfft(CMath::Buffer.new(4), 8) }
+  assert_raise(TypeError) { CMath::FFT.rfft([1, 2i]) }
+end
+
+assert('CMath.czt') do
+  z = Array.new(13) { |i| Complex(Math.cos(i), 0.1 * i) }
+  full = CMath::FFT.forward(CMath::Buffer.new(z))
+  c = CMath.czt(CMath::Buffer.new(z))
+  13.times { |k| assert_complex full[k], c[k] }
+
+  w = CMath.exp(Complex(0, -0.05))
+  a = CMath.exp(Complex(0, 0.3))
+  c = CMath.czt(CMath::Buffer.new(z), 5, w, a)
+  assert_equal 5, c.size
+  5.times do |k|
+    s = 0i
+    z.each_with_index { |x, j| s += x * CMath.exp(Complex(0, -0.3 * j - 0.05 * j * k)) }
+    assert_complex s, c[k]
+  end
+  assert_raise(ArgumentError) { CMath.czt(CMath::Buffer.new(z), 4, 0) }
+end
+
+assert('CMath::FFT 2D, 3D and batches') do
+  z = Array.new(60) { |i| Complex(Math.sin(0.7 * i), Math.cos(0.05 * i * i)) }
+
+  # Each axis in turn, with the one-dimensional transform
+  ref = CMath::Buffer.new(z)
+  CMath::FFT.forward_many(ref, 5)
+  CMath::FFT.forward_many(ref, 12, 5, 1)
+  buf = CMath::Buffer.new(z)
+  assert_same buf, CMath::FFT.forward2(buf, 12, 5)
+  60.times { |i| assert_complex ref[i], buf[i] }
+  CMath::FFT.inverse2(buf, 12, 5)
+  60.times { |i| assert_complex z[i], buf[i] }
+
+  buf = CMath::FFT.forward3(CMath::Buffer.new(z), 3, 4, 5)
+  [[0, 0, 0], [1, 2, 3], [2, 3, 4]].each do |k0, k1, k2|
+    s = 0i
+    z.each_with_index do |x, j|
+      t = k0 * (j / 20) / 3.0 + k1 * (j / 5 % 4) / 4.0 + k2 * (j % 5) / 5.0
+      s += x * CMath.exp(Complex(0, -2 * Math::PI * t))
+    end
+    assert_complex s, buf[20 * k0 + 5 * k1 + k2]
+  end
+  CMath::FFT.inverse3(buf, 3, 4, 5)
+  60.times { |i| assert_complex z[i], buf[i] }
+
+  frames = CMath::FFT.forward_many(CMath::Buffer.new(z), 12)
+  one = CMath::FFT.forward(CMath::Buffer.new(z[24, 12]))
+  12.times { |k| assert_complex one[k], frames[24 + k] }
+  assert_raise(ArgumentError) { CMath::FFT.forward2(CMath::Buffer.new(z), 7, 8) }
+  assert_raise(ArgumentError) { CMath::FFT.forward_many(CMath::Buffer.new(z), 61) }
+  assert_raise(ArgumentError) { CMath::FFT.forward_many(CMath::Buffer.new(z), 10, 1, 5) }
+end
+
+assert('CMath.convolve and correlate') do
+  a = Array.new(45) { |i| Complex(Math.sin(0.3 * i), 0.02 * i) }
+  b = Array.new(37) { |i| Complex(1.0 / (i + 1), Math.cos(i)) }
+  ref = Array.new(81) { 0i }
+  a.each_with_index { |x, i| b.each_with_index { |y, j| ref[i + j] += x * y } }
+  [:auto, :direct, :fft].each do |method|
+    c = CMath.convolve(a, CMath::Buffer.new(b), method)
+    assert_equal 81, c.size
+    81.times { |k| assert_complex ref[k], c[k] }
+  end
+  c = CMath.convolve([1, 2, 3], [0, 1, 0.5])
+  assert_equal [0, 1, 2.5, 4, 1.5], c.to_a.map(&:real)
+
+  r = CMath.correlate(a, b)
+  assert_equal 81, r.size
+  [-36, -5, 0, 7, 44].each do |k|
+    s = 0i
+    b.each_with_index { |y, j| s += a[j + k] * y.conjugate if j + k >= 0 && j + k < 45 }
+    assert_complex s, r[k + 36]
+  end
+  assert_raise(ArgumentError) { CMath.convolve([], [1]) }
+  assert_raise(ArgumentError) { CMath.convolve([1], [1], :fast) }
+  assert_raise(TypeError) { CMath.convolve(1, [1]) }
+end
+
+assert('CMath::OverlapAdd and OverlapSave') do
+  x = Array.new(200) { |i| Complex(Math.cos(0.1 * i), Math.sin(0.37 * i)) }
+  h = Array.new(19) { |i| Complex(0.5**i, 0.1 * i) }
+  ref = CMath.convolve(x, h, :direct)
+  [CMath::OverlapAdd, CMath::OverlapSave].each do |klass|
+    [nil, 1, 7, 64].each do |block|
+      f = block ? klass.new(h, block) : klass.new(h)
+      assert_equal 19, f.kernel_size
+      assert_true f.block_size >= (block || 1)
+      2.times do
+        out = []
+        pos = 0
+        [1, 30, 3, 100, 66].each do |n|
+          out.concat(f.process(x[pos, n]).to_a)
+          pos += n
+        end
+        flushed = f.flush
+        assert_equal 18, flushed.size
+        out.concat(flushed.to_a)
+        assert_equal 218, out.size
+        218.times { |k| assert_complex ref[k], out[k] }
+      end
+      f.process(x[0, 50])
+      f.reset
+      y = f.process(CMath::Buffer.new(x[0, 10]))
+      10.times { |k| assert_complex ref[k], y[k] }
+    end
+  end
+  assert_raise(ArgumentError) { CMath::OverlapAdd.new([]) }
+  assert_raise(ArgumentError) { CMath::OverlapSave.new([1], 0) }
+end
@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+"""Print the bits of 2/pi as the 32-bit words of src/two_over_pi.h.
+
+pi is computed with Machin's formula in fixed point on Python integers,
+with guard bits to spare, so the table does not depend on any floating
+point library.
+
+    python3 tools/two_over_pi.py > src/two_over_pi.h
+"""
+
+WORDS = 40
+GUARD = 64
+
+
+def atan_inv(x, one):
+    """atan(1/x) in fixed point with the given unit"""
+    total = term = one // x
+    x2 = x * x
+    k = 1
+    while term:
+        term //= x2
+        k += 2
+        total += -(term // k) if k % 4 == 3 else term // k
+    return total
+
+
+def main():
+    bits = 32 * WORDS + GUARD
+    one = 1 << bits
+    pi = 16 * atan_inv(5, one) - 4 * atan_inv(239, one)
+    # 2/pi scaled by 2**(32*WORDS), truncated
+    two_over_pi = (2 << (bits + 32 * WORDS)) // pi
+    words = [(two_over_pi >> (32 * (WORDS - 1 - i))) & 0xFFFFFFFF for i in range(WORDS)]
+
+    print("/*")
+    print("** two_over_pi.h - bits of 2/pi for the Payne-Hanek reduction in trig.c")
+    print("**")
+    print("** Generated by tools/two_over_pi.py; do not edit.")
+    print("*/")
+    print()
+    print("/* 2/pi = sum of cmath_two_over_pi[k] * 2**(-32*(k+1)) */")
+    print("static const uint32_t cmath_two_over_pi[%d] = {" % WORDS)
+    for i in range(0, WORDS, 4):
+        print("  " + " ".join("0x%08X," % w for w in words[i:i + 4]))
+    print("};")
+
+
+if __name__ == "__main__":
+    main()